@@ -0,0 +1,151 @@
+#include "common.h"
+#include "trace.h"
+#include "util.h"
+
+// Frame time benchmark, drives the model and the offscreen view
+// through standard scenarios without a display
+
+#define BENCH_WINDOW_WIDTH      1280
+#define BENCH_WINDOW_HEIGHT     1024
+#define ZOOM_STEPS              22
+#define CONTINUITY_TOGGLES      20
+#define MAX_FRAMES              100000
+
+typedef struct {
+  char *name;
+  long frame_time[MAX_FRAMES];
+  int num_of_frames;
+} scenario_t;
+
+static int compare_times(const void *a, const void *b)
+{
+  long time_a = *(const long *) a, time_b = *(const long *) b;
+
+  return (time_a > time_b) - (time_a < time_b);
+}
+
+static double get_percentile(scenario_t *scenario, int percentile)
+{
+  return scenario->frame_time[(scenario->num_of_frames - 1) * percentile / 100] / 1000.0;
+}
+
+static void print_scenario(scenario_t *scenario)
+{
+  if (!scenario->num_of_frames)
+    return;
+
+  qsort(scenario->frame_time, scenario->num_of_frames, sizeof(long), compare_times);
+  printf("%-12s %6d frames  p50 %8.2f ms  p95 %8.2f ms  p99 %8.2f ms  max %8.2f ms\n",
+      scenario->name, scenario->num_of_frames, get_percentile(scenario, 50),
+      get_percentile(scenario, 95), get_percentile(scenario, 99), get_percentile(scenario, 100));
+}
+
+// Model and view run back to back here, without the pipeline threads
+static frame_t *run_event(readerx_t *readerx, scenario_t *scenario, event_t event)
+{
+  frame_t *frame;
+  long start = g_get_monotonic_time();
+
+  frame = model_main(readerx->model, event);
+  if (frame)
+    view_main(readerx->view, frame);
+
+  if (scenario && scenario->num_of_frames < MAX_FRAMES)
+    scenario->frame_time[scenario->num_of_frames++] = g_get_monotonic_time() - start;
+
+  return frame;
+}
+
+static frame_t *run_frame(readerx_t *readerx, scenario_t *scenario, event_type_t type, int rep)
+{
+  event_t event = { type, rep, { BENCH_WINDOW_WIDTH, BENCH_WINDOW_HEIGHT } };
+
+  return run_event(readerx, scenario, event);
+}
+
+static common_t *init_headless_common(char *uri)
+{
+  common_t *common = malloc(sizeof(common_t));
+
+  common->display = NULL;
+  common->screen = NULL;
+  common->drawable = 0;
+  common->input_file = uri;
+  common->document = NULL;
+  common->wakeup_fd = common->timer_fd = common->search_fd = common->input_fd = -1;
+  common->timer_deadline = 0;
+  common->incomplete = 0;
+  common->profiler = NULL;
+  common->governor = NULL;
+  common->window_size.x = BENCH_WINDOW_WIDTH;
+  common->window_size.y = BENCH_WINDOW_HEIGHT;
+
+  return common;
+}
+
+int main(int argc, char *argv[])
+{
+  readerx_t readerx;
+  common_t *common;
+  scenario_t *scenario;
+  trace_t *trace;
+  frame_t *frame;
+  event_t event;
+  char *uri, *path;
+  int i;
+
+  if (!(uri = parse_input(argc, argv)))
+    return 1;
+
+  common = init_headless_common(uri);
+  if (!(readerx.model = init_model(common)) || !(readerx.view = init_view(common)))
+    return 1;
+
+  // init_model sizes the window to the first page, events bring it back
+  run_frame(&readerx, NULL, Resize, 1);
+
+  scenario = malloc(sizeof(scenario_t));
+
+  // Scroll through the whole document in continuous mode
+  scenario->name = "scroll";
+  scenario->num_of_frames = 0;
+  run_frame(&readerx, NULL, Continuity, 1);
+  do
+    frame = run_frame(&readerx, scenario, ScrollDown, 1);
+  while (frame && (frame->redraw || frame->scroll.x || frame->scroll.y));
+  print_scenario(scenario);
+
+  // Zoom all the way in and back out
+  scenario->name = "zoom";
+  scenario->num_of_frames = 0;
+  run_frame(&readerx, NULL, Jump, 1);
+  for (i = 0; i < ZOOM_STEPS; i++)
+    run_frame(&readerx, scenario, ZoomIn, 1);
+  for (i = 0; i < ZOOM_STEPS; i++)
+    run_frame(&readerx, scenario, ZoomOut, 1);
+  print_scenario(scenario);
+
+  scenario->name = "continuity";
+  scenario->num_of_frames = 0;
+  for (i = 0; i < CONTINUITY_TOGGLES; i++)
+    run_frame(&readerx, scenario, Continuity, 1);
+  print_scenario(scenario);
+
+  // Replay a recorded session at full speed
+  if ((path = getenv("READERX_REPLAY")) && (trace = init_trace_player(common, path, 0))) {
+    scenario->name = "replay";
+    scenario->num_of_frames = 0;
+    while (read_trace_event(trace, &event) && event.type != Exit)
+      run_event(&readerx, scenario, event);
+    print_scenario(scenario);
+    deinit_trace(trace);
+  }
+
+  free(scenario);
+  deinit_view(readerx.view);
+  deinit_model(readerx.model);
+  free(common->input_file);
+  free(common);
+
+  return 0;
+}
@@ -0,0 +1,29 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+// Alignment of every allocation, enough for doubles and pointers
+#define ARENA_ALIGNMENT 16
+
+typedef struct arena_chunk {
+  struct arena_chunk *next;
+  size_t size;
+  size_t used;
+  char data[] __attribute__((aligned(ARENA_ALIGNMENT)));
+} arena_chunk_t;
+
+// Bump allocator for objects that live exactly one frame, everything is
+// released at once by resetting it. It grows to the largest frame seen
+// and then stops allocating.
+typedef struct arena {
+  arena_chunk_t *head;
+  long allocations;
+} arena_t;
+
+arena_t *init_arena(size_t size);
+void deinit_arena(arena_t *arena);
+void *arena_alloc(arena_t *arena, size_t size);
+void reset_arena(arena_t *arena);
+
+#endif
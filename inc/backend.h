@@ -0,0 +1,10 @@
+#ifndef BACKEND_H
+#define BACKEND_H
+
+#include "view.h"
+
+extern backend_t shm_backend;
+extern backend_t pixmap_backend;
+extern backend_t offscreen_backend;
+
+#endif
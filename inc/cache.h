@@ -0,0 +1,58 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <cairo/cairo.h>
+#include <glib-2.0/glib.h>
+
+#include "common.h"
+
+// Default budget for rendered pages, READERX_CACHE_MB overrides it
+#define PAGE_CACHE_BUDGET       (256L * 1024 * 1024)
+
+// Tile coordinates of a whole page
+#define WHOLE_PAGE              -1
+
+// Tile coordinates of a page thumbnail, embedded ones are used if the
+// document has them
+#define THUMBNAIL               -2
+
+typedef struct {
+  int page_no;
+  double scaling;
+  dim_t tile;
+} cache_key_t;
+
+typedef struct cache_entry {
+  cache_key_t key;
+  cairo_surface_t *surface;
+  long bytes;
+  struct cache_entry *prev;
+  struct cache_entry *next;
+} cache_entry_t;
+
+// LRU cache of rendered pages and tiles, the most recently used entry is the head
+typedef struct {
+  GHashTable *table;
+  cache_entry_t *head;
+  cache_entry_t *tail;
+  long budget;
+  long bytes;
+  long hits;
+  long misses;
+  long evictions;
+} cache_t;
+
+guint hash_cache_key(gconstpointer data);
+gboolean equal_cache_keys(gconstpointer a, gconstpointer b);
+
+cache_t *init_cache(long budget);
+void deinit_cache(cache_t *cache);
+
+cache_key_t get_cache_key(int page_no, double scaling, int tile_x, int tile_y);
+cairo_surface_t *find_cached_surface(cache_t *cache, cache_key_t *key);
+cairo_surface_t *peek_cached_surface(cache_t *cache, cache_key_t *key);
+void cache_surface(cache_t *cache, cache_key_t *key, cairo_surface_t *surface);
+long trim_cache(cache_t *cache, long bytes);
+void print_cache_stats(cache_t *cache, FILE *stream);
+
+#endif
@@ -6,6 +6,7 @@
 #include <unistd.h>
 #include <math.h>
 #include <X11/Xlib.h>
+#include <glib-2.0/glib.h>
 
 /* RGB gray values */
 #define READERX_BACKGROUND_DARK   0x7F7F7F
@@ -14,8 +15,8 @@
 /* Default window dimensions are 100x100 */
 #define DEFAULT_WINDOW_DIM        100
 
-/* Max queue length */
-#define MAX_QUEUE_LENGTH          10
+/* Window title with the document path */
+#define TITLE_MAX                 400
 
 /* Dimension datatypes */
 typedef struct {
@@ -50,18 +51,31 @@ typedef enum event_type {
   ZoomFit,
   ZoomIn,
   ZoomOut,
-  Exit
+  Exit,
+  Timer,
+  Hud,
+  SearchPrompt,
+  Search,
+  SearchNext,
+  SearchPrevious,
+  SearchProgress,
+  Overview,
+  Select,
+  Layout
 } event_type_t;
 
-/* Event type */
+/* Event type, carries the window size the controller saw so the model
+   thread does not share it with the X thread. Search and SearchPrompt
+   events own their text, a NULL prompt closes it. */
 typedef struct {
   event_type_t type;
   int rep;
+  dim_t window_size;
+  char *text;
 } event_t;
 
 /* Scene datatype */
 typedef struct {
-  void *page;
   int visible;
   int page_no;
   fdim_t page_size;
@@ -69,21 +83,52 @@ typedef struct {
   fdim_t scaling;
 } scene_t;
 
+struct profiler;
+struct governor;
+struct arena;
+struct queue;
+
 typedef struct {
   Display *display;
   Screen *screen;
   Drawable drawable;
   dim_t window_size;
   char *input_file;
-  char window_title[200];
+  GBytes *document;
+  int wakeup_fd;
+  int timer_fd;
+  int search_fd;
+  int input_fd;
+  long timer_deadline;
+  // Set by the view when an animated frame left pages out, the model
+  // redraws in full once the animation settles
+  volatile gint incomplete;
+  struct profiler *profiler;
+  struct governor *governor;
 } common_t;
 
-/* Queue for passing scenes */
+/* Frame datatype, when redraw is not set the frame only carries the
+   scenes in the strips exposed by scrolling the last one. The scenes
+   live in the arena, which the view resets once the frame is shown.
+   Started is when the first event that went into the frame arrived,
+   the generation counts frames and tags the renders they ask for.
+   Animated frames are on the way to the model position. */
 typedef struct {
-  int head;
-  int tail;
-  void *q[MAX_QUEUE_LENGTH];
-} queue_t;
+  struct queue *scenes;
+  struct arena *arena;
+  int generation;
+  int redraw;
+  int animated;
+  dim_t scroll;
+  dim_t window_size;
+  char title[TITLE_MAX];
+  struct search *search;
+  int hit_page;
+  int hit;
+  int overview;
+  int selected;
+  long started;
+} frame_t;
 
 /* controller functions */
 void *init_controller(common_t *common);
@@ -93,18 +138,25 @@ event_t controller_main(void *data);
 /* model functions */
 void *init_model(common_t *common);
 void deinit_model(void *data);
-queue_t *model_main(void *data, event_t);
+int apply_event(void *data, event_t event);
+frame_t *build_frame(void *data);
+frame_t *model_main(void *data, event_t);
 
 /* view functions */
 void *init_view(common_t *common);
 void deinit_view(void *data);
-void view_main(void *data, queue_t *scene_queue);
+void view_main(void *data, frame_t *frame);
+void view_wakeup(void *data);
 
 /* readerx datatype */
 typedef struct {
   void *controller;
   void *model;
   void *view;
+  void *trace;
+  void *profiler;
+  void *governor;
+  void *pipeline;
 } readerx_t;
 
 #endif
@@ -62,18 +62,52 @@
 // Exit
 #define EXIT          33
 
+// Profiler overlay (i)
+#define HUD           105
+
+// Page overview (o), Return opens the selected page
+#define OVERVIEW      111
+
+// Page layout (v), a count sets the number of columns
+#define LAYOUT        118
+
+// Search (/, n, N), typed keys go to the prompt until Return or Escape
+#define SEARCH          47
+#define SEARCH_NEXT     110
+#define SEARCH_PREVIOUS 78
+#define RETURN          65293
+#define ESCAPE          65307
+#define BACKSPACE       65288
+#define QUERY_MAX       1024
+
+// Prompt input, these do not come from X
+#define SEARCH_EDIT     -1
+#define SEARCH_DONE     -2
+#define SEARCH_CANCEL   -3
+
 typedef struct {
   common_t *common;
+  dim_t window_size;
   int input;
   int last_input;
   int ctrl_active;
   int input_active;
   int rep;
   event_t event;
+  event_t pending;
+  long coalesced;
+  long x_wakeups;
+  long woken;
+  int searching;
+  char query[QUERY_MAX];
+  int query_length;
 } controller_t;
 
 void set_window_size(controller_t *controller);
+void wait_for_input(controller_t *controller);
 void get_input(controller_t *controller);
+void edit_query(controller_t *controller, KeySym key, char *text, int length);
 void generate_event(controller_t *controller);
+int is_coalescable(event_type_t type);
 
 #endif
@@ -0,0 +1,57 @@
+#ifndef DISK_CACHE_H
+#define DISK_CACHE_H
+
+#include <stdint.h>
+#include <cairo/cairo.h>
+#include <glib-2.0/glib.h>
+
+#include "cache.h"
+
+// Rendered pages survive restarts under $XDG_CACHE_HOME/readerx when
+// READERX_DISK_CACHE_MB sets its size cap
+#define DISK_CACHE_DIR          "readerx"
+#define DISK_CACHE_MAGIC        0x31435852
+
+// Content hash samples, the file ends and evenly spaced chunks between
+#define HASH_EDGE_SIZE          (64 * 1024)
+#define HASH_SAMPLE_SIZE        (4 * 1024)
+#define HASH_SAMPLES            16
+
+// Largest side of an entry, the cairo image surface limit
+#define DISK_ENTRY_MAX_SIDE     32767
+
+typedef struct {
+  uint32_t magic;
+  int32_t width;
+  int32_t height;
+  int32_t stride;
+  uint64_t compressed;
+} disk_entry_header_t;
+
+// Entries are shared by every document, the file name carries the
+// content hash and the cache key. File mtimes order the LRU.
+typedef struct {
+  char *dir;
+  char *hash;
+  long budget;
+  long bytes;
+  GMutex lock;
+  GMutex trim_lock;
+  GThread *trimmer;
+  volatile gint hits;
+  volatile gint misses;
+  volatile gint writes;
+  volatile gint corrupt;
+  volatile gint evictions;
+} disk_cache_t;
+
+char *hash_document(GBytes *document);
+disk_cache_t *init_disk_cache(GBytes *document, long budget);
+void deinit_disk_cache(disk_cache_t *disk_cache);
+char *get_entry_path(disk_cache_t *disk_cache, cache_key_t *key);
+cairo_surface_t *load_surface(disk_cache_t *disk_cache, cache_key_t *key);
+void save_surface(disk_cache_t *disk_cache, cache_key_t *key, cairo_surface_t *surface);
+void trim_disk_cache(disk_cache_t *disk_cache);
+void print_disk_cache_stats(disk_cache_t *disk_cache, FILE *stream);
+
+#endif
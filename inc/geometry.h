@@ -0,0 +1,33 @@
+#ifndef GEOMETRY_H
+#define GEOMETRY_H
+
+#include <poppler.h>
+
+#include "common.h"
+
+// Page geometry index, filled in the background. Dimensions and
+// positions are unscaled, scaling is applied by the caller. Positions
+// past the indexed pages are estimates until the index is complete.
+typedef struct {
+  GBytes *bytes;
+  PopplerDocument *doc;
+  int num_of_pages;
+  fdim_t first_dim;
+  fdim_t *dim;
+  double *position;
+  volatile gint ready;
+  volatile gint cancel;
+  GThread *thread;
+} geometry_t;
+
+geometry_t *init_geometry(GBytes *bytes, PopplerDocument *doc, int num_of_pages, fdim_t *dim);
+void deinit_geometry(geometry_t *geometry);
+
+int is_geometry_ready(geometry_t *geometry);
+fdim_t get_page_dim(geometry_t *geometry, int page_number);
+fdim_t get_estimated_dim(geometry_t *geometry, int page_number);
+double get_page_position(geometry_t *geometry, int page_number);
+double get_total_length(geometry_t *geometry);
+int get_page_at(geometry_t *geometry, double position);
+
+#endif
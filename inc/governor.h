@@ -0,0 +1,53 @@
+#ifndef GOVERNOR_H
+#define GOVERNOR_H
+
+#include <stdio.h>
+#include <glib-2.0/glib.h>
+
+/* Caches that can report to the governor */
+#define GOVERNOR_MAX_CACHES 8
+
+/* RSS is checked at most this often in us */
+#define GOVERNOR_INTERVAL   100000
+
+/* PSI trigger, 150 ms of stalls on memory in a 2 s window. Windows of
+   unprivileged triggers are multiples of 2 s. */
+#define PSI_TRIGGER         "some 150000 2000000"
+
+// A cache reports the bytes it holds. One that can shrink frees about the
+// bytes it is asked for and returns what it freed, the others are only
+// accounted for.
+typedef struct {
+  const char *name;
+  void *data;
+  long (*get_bytes)(void *data);
+  long (*evict)(void *data, long bytes);
+  long evicted;
+} governed_cache_t;
+
+// Keeps the resident memory of this process within its budget and
+// shrinks the caches when the kernel reports memory pressure on the
+// system. Caches register while readerx starts up, govern runs on the
+// view thread, which owns the caches that can shrink.
+typedef struct governor {
+  governed_cache_t caches[GOVERNOR_MAX_CACHES];
+  int num_of_caches;
+  long budget;
+  int psi_fd;
+  const char *psi_error;
+  long last_check;
+  long checks;
+  long over_budget;
+  long pressure_events;
+  long evicted;
+  long peak_rss;
+} governor_t;
+
+governor_t *init_governor(long budget);
+void deinit_governor(governor_t *governor);
+void register_cache(governor_t *governor, const char *name, void *data,
+    long (*get_bytes)(void *data), long (*evict)(void *data, long bytes));
+long govern(governor_t *governor, int pressure);
+void print_governor_stats(governor_t *governor, FILE *stream);
+
+#endif
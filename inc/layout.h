@@ -0,0 +1,41 @@
+#ifndef LAYOUT_H
+#define LAYOUT_H
+
+#include "common.h"
+#include "geometry.h"
+
+// Space between the pages of a row, unscaled
+#define LAYOUT_GAP  8
+
+// Pages are laid out in rows of a number of columns, a book spread has
+// its cover alone on the first row. Rows are measured as they are needed,
+// their positions form an index that is searched for the row in view.
+// Rows from the first estimated one on are measured again once the
+// geometry index is complete. Dimensions and positions are unscaled like
+// the geometry.
+typedef struct {
+  geometry_t *geometry;
+  int columns;
+  int cover;
+  int num_of_rows;
+  int built;
+  int estimated;
+  fdim_t *dim;
+  double *position;
+} layout_t;
+
+layout_t *init_layout(geometry_t *geometry, int columns, int cover);
+void deinit_layout(layout_t *layout);
+void set_layout(layout_t *layout, int columns, int cover);
+
+int get_row(layout_t *layout, int page_number);
+int get_row_start(layout_t *layout, int row);
+int get_row_end(layout_t *layout, int row);
+fdim_t get_row_dim(layout_t *layout, int row);
+double get_row_position(layout_t *layout, int row);
+double get_layout_length(layout_t *layout);
+int get_row_at(layout_t *layout, double position);
+double get_page_x(layout_t *layout, int page_number);
+double get_page_y(layout_t *layout, int page_number);
+
+#endif
@@ -0,0 +1,70 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include <stdio.h>
+#include <glib-2.0/glib.h>
+
+#define LOG_FILEPATH      "./readerx_log.txt"
+
+/* Records in the ring, must be a power of two */
+#define LOG_RING_SIZE     4096
+#define LOG_MAX_ARGS      8
+#define LOG_STRING_SPACE  64
+
+/* Flush interval of the logger thread in us */
+#define LOG_FLUSH_PERIOD  100000
+
+#define LOG_UNKNOWN       0
+#define LOG_OFF           1
+#define LOG_ON            2
+
+/* Logging stays compiled in, READERX_LOG enables it per module at
+   runtime, e.g. READERX_LOG=view,render or READERX_LOG=all. Each call
+   site looks its module up once. */
+#define LOG(...) \
+  do { \
+    static volatile gint log_state; \
+    if (!g_atomic_int_get(&log_state)) \
+      g_atomic_int_set(&log_state, get_log_state(__FILE__)); \
+    if (g_atomic_int_get(&log_state) == LOG_ON) \
+      readerx_log(__FILE__, __func__, __LINE__, __VA_ARGS__); \
+  } while (0)
+
+typedef union {
+  long i;
+  double f;
+  const void *p;
+} log_arg_t;
+
+/* Arguments are kept in binary and only formatted when flushed, strings
+   are copied since they may be gone by then */
+typedef struct {
+  volatile gint sequence;
+  long timestamp;
+  const char *file;
+  const char *func;
+  int line;
+  const char *fmt;
+  int num_of_args;
+  log_arg_t args[LOG_MAX_ARGS];
+  char strings[LOG_STRING_SPACE];
+} log_record_t;
+
+typedef struct {
+  log_record_t records[LOG_RING_SIZE];
+  volatile gint head;
+  volatile gint tail;
+  volatile gint dropped;
+  FILE *file;
+  GThread *thread;
+  GMutex lock;
+  GCond cond;
+  int quit;
+} logger_t;
+
+int get_log_state(const char *file);
+void flush_log(void);
+int readerx_log(const char *file, const char *func, int line, const char *fmt, ...)
+  __attribute__((format(printf, 4, 5)));
+
+#endif
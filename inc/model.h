@@ -4,11 +4,31 @@
 #include <poppler.h>
 
 #include "common.h"
+#include "geometry.h"
+#include "layout.h"
+#include "sidecar.h"
+#include "arena.h"
+#include "pages.h"
+#include "queue.h"
+#include "search.h"
+
+// Scenes of a frame, the arena grows if a frame needs more
+#define SCENE_ARENA_SIZE        (32 * sizeof(scene_t))
 
 // Navigation settings
 #define VERTICAL_SCROLL_SPEED   48
 #define HORIZONTAL_SCROLL_SPEED 24
 
+// Smooth scrolling, the view glides to a new position over a few
+// refresh intervals
+#define DEFAULT_REFRESH_RATE    60
+#define ANIMATION_FRAMES        8
+
+// Overview grid, thumbnails fit in a box of this size
+#define THUMBNAIL_WIDTH         160
+#define THUMBNAIL_HEIGHT        208
+#define THUMBNAIL_GAP           16
+
 // Zoom settings
 #define BASE_SCALING            2.25
 #define ZOOM_LUT_LENGTH         23
@@ -81,9 +101,31 @@ typedef struct {
   fdim_t dim;
 } page_t;
 
+// Positions are the horizontal offset and the vertical margin
+typedef struct {
+  int active;
+  dim_t from;
+  dim_t to;
+  long start;
+  long duration;
+  long interval;
+} animation_t;
+
+// What the last frame showed, scrolls are drawn relative to it
+typedef struct {
+  int page_number;
+  int margin;
+  int offset;
+  double scaling;
+  int continuity;
+  dim_t window_size;
+} viewport_t;
+
 typedef struct {
   common_t *common;
   PopplerDocument *doc;
+  geometry_t *geometry;
+  layout_t *layout;
   page_t page;
   int continuity;
   fit_mode_t fit;
@@ -92,17 +134,61 @@ typedef struct {
   int offset;
   int num_of_pages;
   queue_t *queue;
+  frame_t frame;
+  int redraw;
+  long pending_since;
+  int animate;
+  animation_t animation;
+  long animation_frames;
+  search_t *search;
+  char *prompt;
+  char *query;
+  int search_jumped;
+  int hit_page;
+  int hit;
+  int hit_margin;
+  int hit_serial;
+  long highlight_frames;
+  int overview;
+  int selected;
+  int overview_margin;
+  viewport_t viewport;
+  int stamped;
+  int64_t mtime;
+  int64_t size;
+  long open_time;
+  long open_rss;
+  arena_t *arena;
+  page_handles_t *pages;
 } model_t;
 
 int get_scaling_index(int page_height, int window_height);
+int restore_viewport(model_t *model, sidecar_t *sidecar);
+void save_viewport(model_t *model);
 long get_document_length(model_t *model);
 void set_page(model_t *model, int page_number);
 fdim_t get_page_size(model_t *model, int page_number);
+fdim_t get_row_size(model_t *model, int row);
+int get_row_margin(model_t *model, int row);
+int get_page_margin(model_t *model, int page_number);
 int get_visible_length(int window_length, int page_length, int margin);
 
 scene_t *create_scene(model_t *model, int page, int offset_x, int offset_y);
+void update_frame(model_t *model);
+int is_exposed(model_t *model, int margin, int page_length);
+void add_row_scenes(model_t *model, int row, int margin);
 void update_model(model_t *model);
+int have_highlights_changed(model_t *model, dim_t position);
+int get_overview_columns(model_t *model);
+void update_overview(model_t *model);
 void update_window_title(model_t *model);
+void check_borders(model_t *model);
+
+int is_animated(event_type_t type);
+int is_status_event(event_type_t type);
+dim_t get_animated_position(model_t *model, long now);
+int start_animation(model_t *model, dim_t from, int page_number, long now);
+void arm_frame_timer(model_t *model, long now);
 
 void resize_event_handler(model_t *model);
 void previous_page_event_handler(model_t *model);
@@ -113,6 +199,15 @@ void scroll_left_event_handler(model_t *model, int rep);
 void scroll_right_event_handler(model_t *model, int rep);
 void next_page_event_handler(model_t *model);
 void continuity_event_handler(model_t *model);
-void zoom_in_event_handler(model_t *model);
-void zoom_out_event_handler(model_t *model);
+void zoom_in_event_handler(model_t *model, int rep);
+void zoom_out_event_handler(model_t *model, int rep);
+void layout_event_handler(model_t *model, int rep);
+int is_overview_event(event_type_t type);
+void show_selection(model_t *model);
+int overview_event_handler(model_t *model, event_t event);
+void search_prompt_event_handler(model_t *model, char *prompt);
+void search_event_handler(model_t *model, char *query);
+void jump_to_match(model_t *model);
+void search_next_event_handler(model_t *model, int rep, int direction);
+int search_progress_event_handler(model_t *model);
 #endif
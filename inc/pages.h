@@ -0,0 +1,29 @@
+#ifndef PAGES_H
+#define PAGES_H
+
+#include <poppler.h>
+
+// Live page handles kept around the viewport
+#define PAGE_HANDLE_CACHE_SIZE  16
+
+typedef struct {
+  int page_number;
+  PopplerPage *page;
+  long last_used;
+} page_handle_t;
+
+// Poppler documents are not shared between threads, the model and the
+// view each keep handles into their own
+typedef struct {
+  PopplerDocument *doc;
+  page_handle_t handles[PAGE_HANDLE_CACHE_SIZE];
+  long clock;
+  long hits;
+  long misses;
+} page_handles_t;
+
+page_handles_t *init_page_handles(PopplerDocument *doc);
+void deinit_page_handles(page_handles_t *handles);
+PopplerPage *get_page_handle(page_handles_t *handles, int page_number);
+
+#endif
@@ -0,0 +1,39 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include "common.h"
+#include "queue.h"
+
+// Events the model thread takes off the queue at once
+#define EVENT_BATCH 64
+
+// The controller, the model and the view run on their own threads and
+// hand events and frames down single producer, single consumer queues.
+// A consumer sleeps on its eventfd until the producer rings it after a
+// push. While the view is busy the model keeps applying events and
+// builds one frame from all of them once the view is done, so neither
+// input nor model updates wait for rendering. The frame timer of
+// animations belongs to the model thread.
+typedef struct {
+  readerx_t *readerx;
+  common_t *common;
+  queue_t *events;
+  queue_t *frames;
+  int model_fd;
+  int view_fd;
+  volatile gint frames_in_flight;
+  GThread *model_thread;
+  GThread *view_thread;
+  long events_applied;
+  long frames_built;
+  long ticks;
+  long skipped_ticks;
+  long tick_latency;
+  long max_tick_latency;
+} pipeline_t;
+
+pipeline_t *init_pipeline(readerx_t *readerx, common_t *common);
+void deinit_pipeline(pipeline_t *pipeline);
+void send_event(pipeline_t *pipeline, event_t event);
+
+#endif
@@ -0,0 +1,56 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <stdio.h>
+#include <glib-2.0/glib.h>
+
+/* Samples kept for the rolling percentiles */
+#define PROFILE_WINDOW  128
+
+/* Power of two buckets in us, the last one holds everything above 4 s */
+#define PROFILE_BUCKETS 24
+
+typedef enum {
+  INPUT_STAGE,
+  MODEL_STAGE,
+  VIEW_STAGE,
+  RENDER_STAGE,
+  PRESENT_STAGE,
+  WAKEUP_STAGE,
+  FRAME_STAGE,
+  STAGE_COUNT
+} profile_stage_t;
+
+typedef enum {
+  ALLOCATION_COUNTER,
+  COUNTER_COUNT
+} profile_counter_t;
+
+typedef struct {
+  long window[PROFILE_WINDOW];
+  int next;
+  long buckets[PROFILE_BUCKETS];
+  long samples;
+  long total;
+  long max;
+} histogram_t;
+
+// Stages are sampled from the controller, model and view threads
+typedef struct profiler {
+  GMutex lock;
+  histogram_t stages[STAGE_COUNT];
+  histogram_t counters[COUNTER_COUNT];
+  volatile gint hud;
+} profiler_t;
+
+profiler_t *init_profiler(void);
+void deinit_profiler(profiler_t *profiler);
+char *get_stage_name(profile_stage_t stage);
+char *get_counter_name(profile_counter_t counter);
+void add_sample(profiler_t *profiler, profile_stage_t stage, long usec);
+void add_count(profiler_t *profiler, profile_counter_t counter, long count);
+void get_profile(profiler_t *profiler, histogram_t *stages, histogram_t *counters);
+long get_rolling_percentile(histogram_t *histogram, int percentile);
+void print_profile(profiler_t *profiler, FILE *stream);
+
+#endif
@@ -0,0 +1,36 @@
+#ifndef QUEUE_H
+#define QUEUE_H
+
+#include <stddef.h>
+#include <glib-2.0/glib.h>
+
+// Items in the first ring, rings double whenever one fills up
+#define QUEUE_RING_LENGTH 16
+
+typedef struct queue_ring {
+  struct queue_ring *volatile next;
+  volatile gint head;
+  volatile gint tail;
+  guint capacity;
+  char items[] __attribute__((aligned(16)));
+} queue_ring_t;
+
+// Lock-free single producer, single consumer queue of fixed size items.
+// When the ring is full the producer continues in a new one twice the
+// size, the consumer follows once it has drained the old one, so a push
+// never fails and never waits. Head and tail count up freely.
+typedef struct queue {
+  queue_ring_t *read;
+  queue_ring_t *write;
+  size_t item_size;
+  long growths;
+} queue_t;
+
+queue_t *init_queue(size_t item_size);
+void deinit_queue(queue_t *queue);
+void enqueue_batch(queue_t *queue, const void *items, int count);
+int dequeue_batch(queue_t *queue, void *items, int max);
+void enqueue(queue_t *queue, const void *item);
+int dequeue(queue_t *queue, void *item);
+
+#endif
@@ -0,0 +1,83 @@
+#ifndef RENDER_H
+#define RENDER_H
+
+#include <poppler.h>
+
+#include "common.h"
+#include "cache.h"
+#include "disk_cache.h"
+
+// Pages larger than this many pixels are rendered in tiles
+#define TILED_PAGE_AREA         (2048L * 2048)
+#define TILE_SIZE               256
+
+typedef enum render_priority {
+  VISIBLE_PRIORITY,
+  PREFETCH_PRIORITY,
+  BACKGROUND_PRIORITY,
+  PRIORITY_COUNT
+} render_priority_t;
+
+// The generation is that of the newest frame that asked for the job,
+// the view raises it while the job is on its way
+typedef struct render_job {
+  cache_key_t key;
+  render_priority_t priority;
+  volatile gint generation;
+  int cancelled;
+  cairo_surface_t *surface;
+  long finished;
+  struct render_job *next;
+} render_job_t;
+
+struct render_pool;
+
+// Every worker renders from its own document and owns a queue per
+// priority, idle workers steal from the others
+typedef struct {
+  struct render_pool *pool;
+  PopplerDocument *doc;
+  GThread *thread;
+  GMutex lock;
+  render_job_t *head[PRIORITY_COUNT];
+  render_job_t *tail[PRIORITY_COUNT];
+  long rendered;
+  long stolen;
+  long embedded;
+  long cancelled;
+  long wasted;
+  long useful_time;
+  long wasted_time;
+} worker_t;
+
+typedef struct render_pool {
+  GBytes *bytes;
+  int num_of_workers;
+  worker_t *workers;
+  int next_worker;
+  GMutex lock;
+  GCond cond;
+  int pending;
+  int quit;
+  GAsyncQueue *done;
+  int wakeup_fd;
+  disk_cache_t *disk_cache;
+  volatile gint generation;
+} render_pool_t;
+
+int is_tiled(double width, double height);
+cairo_surface_t *render_page(PopplerPage *page, double scaling);
+cairo_surface_t *render_tile(PopplerPage *page, double scaling, dim_t tile);
+cairo_surface_t *render_thumbnail(PopplerPage *page, double scaling, int *embedded);
+
+render_pool_t *init_render_pool(GBytes *bytes, int num_of_workers, int wakeup_fd,
+    disk_cache_t *disk_cache);
+void deinit_render_pool(render_pool_t *pool);
+render_job_t *submit_render_job(render_pool_t *pool, cache_key_t *key,
+    render_priority_t priority, int generation);
+void set_render_generation(render_pool_t *pool, int generation);
+render_job_t *collect_render_job(render_pool_t *pool, int wait);
+void free_render_job(render_job_t *job);
+void print_render_stats(render_pool_t *pool, FILE *stream);
+
+#endif
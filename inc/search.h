@@ -0,0 +1,78 @@
+#ifndef SEARCH_H
+#define SEARCH_H
+
+#include <poppler.h>
+
+#include "common.h"
+
+// Longest query in characters
+#define SEARCH_MAX  256
+
+// Character boxes in page coordinates
+typedef struct {
+  float x1, y1, x2, y2;
+} text_box_t;
+
+// One box per character of the page text
+typedef struct {
+  int length;
+  text_box_t *boxes;
+} text_layout_t;
+
+// Highlight of a match in page coordinates, a match across lines has a
+// box on each line
+typedef struct {
+  int match;
+  float x, y, width, height;
+} hit_t;
+
+// Text is extracted on all cores into a cache that lives as long as the
+// document, so only the first search pays for poppler_page_get_text.
+// Pages are searched from the page the search started on outward, a
+// newer search takes over the workers of the last one.
+typedef struct search {
+  GBytes *bytes;
+  int num_of_pages;
+  int num_of_workers;
+  GThread **threads;
+  GMutex lock;
+  GCond cond;
+  int quit;
+  char **text;
+  text_layout_t **layouts;
+  int generation;
+  gunichar query[SEARCH_MAX];
+  int query_length;
+  int *order;
+  int next;
+  int searched;
+  int *matches;
+  hit_t **hits;
+  int *num_of_hits;
+  int *hit_stamps;
+  int hit_serial;
+  int wakeup_fd;
+  long extracted;
+  long extracted_bytes;
+  long cache_hits;
+  long extract_time;
+  long layouts_extracted;
+  long layout_bytes;
+} search_t;
+
+search_t *init_search(GBytes *bytes, int num_of_pages, int num_of_workers, int wakeup_fd);
+void deinit_search(search_t *search);
+void start_search(search_t *search, char *query, int page);
+int count_matches(const char *text, gunichar *query, int query_length, int *offsets);
+int get_search_result(search_t *search, int page, int direction);
+int get_first_result(search_t *search, int page);
+int get_match_count(search_t *search, int page);
+int get_match_box(search_t *search, int page, int match, hit_t *box);
+int get_page_hits(search_t *search, int page, hit_t *hits, int max);
+int get_hit_serial(search_t *search);
+int get_hit_stamp(search_t *search, int page);
+long get_search_bytes(search_t *search);
+void get_search_progress(search_t *search, int *searched, int *pages, long *matches);
+void print_search_stats(search_t *search, FILE *stream);
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef SIDECAR_H
+#define SIDECAR_H
+
+#include <stdint.h>
+
+#include "common.h"
+
+// Per document state kept next to the disk cache, named after the path
+// and only trusted while the mtime and size still match
+#define SIDECAR_DIR     "documents"
+#define SIDECAR_MAGIC   "RXSIDE02"
+
+typedef struct {
+  char magic[8];
+  int64_t mtime;
+  int64_t size;
+  int32_t num_of_pages;
+  int32_t num_of_dims;
+  int32_t page_number;
+  int32_t margin;
+  int32_t offset;
+  int32_t continuity;
+  int32_t fit;
+  int32_t scaling_index;
+  int32_t columns;
+  int32_t cover;
+  double scaling;
+  fdim_t page_dim;
+  dim_t window_size;
+} sidecar_header_t;
+
+// The page dimension table follows the header when it was complete
+typedef struct {
+  sidecar_header_t header;
+  fdim_t *dim;
+} sidecar_t;
+
+char *get_sidecar_path(char *uri);
+int stamp_document(char *uri, int64_t *mtime, int64_t *size);
+sidecar_t *load_sidecar(char *uri, int64_t mtime, int64_t size, int num_of_pages);
+void save_sidecar(char *uri, sidecar_t *sidecar);
+void free_sidecar(sidecar_t *sidecar);
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+#include "common.h"
+
+/* Trace files start with the magic followed by fixed size records
+   in host byte order */
+#define TRACE_MAGIC     "RXTRACE1"
+#define TRACE_MAGIC_LEN 8
+
+typedef struct {
+  int32_t type;
+  int32_t rep;
+  int64_t timestamp;
+  int32_t width;
+  int32_t height;
+} trace_record_t;
+
+typedef struct {
+  common_t *common;
+  FILE *file;
+  int replay;
+  double speed;
+  long start;
+  trace_record_t next;
+  int has_next;
+  dim_t window_size;
+  long events;
+} trace_t;
+
+trace_t *init_trace_recorder(common_t *common, char *path);
+trace_t *init_trace_player(common_t *common, char *path, double speed);
+trace_t *init_trace(common_t *common);
+void deinit_trace(trace_t *trace);
+void record_event(trace_t *trace, event_t event);
+int read_trace_event(trace_t *trace, event_t *event);
+long get_trace_delay(trace_t *trace);
+event_t trace_main(trace_t *trace);
+
+#endif
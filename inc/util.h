@@ -6,21 +6,20 @@
 #include <time.h>
 #include <glib-2.0/glib.h>
 
-//#define LOG_ENABLE
+#include "log.h"
 
 #define STR_MAX 400
-#define LOG_FILEPATH "./readerx_log.txt"
 
-#ifdef LOG_ENABLE
-#define LOG(...) \
-  readerx_log(__FILE__, __func__, __LINE__, __VA_ARGS__);
-#else
-#define LOG(...) do {} while(0);
-#endif
+/* Start and end of a document that are read ahead when it is mapped,
+   the header and the first page of linearized files, the xref table */
+#define DOCUMENT_HEAD_SIZE  (1L * 1024 * 1024)
+#define DOCUMENT_TAIL_SIZE  (4L * 1024 * 1024)
 
-char *get_datetime(void);
+FILE *get_stats_stream(void);
+void print_bandwidth(FILE *stream, char *name, long bytes, long usec);
+void arm_timer(common_t *common, long usec);
+long get_rss(void);
+long get_peak_rss(void);
+GBytes *map_document(char *uri);
 char *parse_input(int input_num, char **input_str);
-int enqueue(queue_t *queue, void *item);
-void *dequeue(queue_t *queue);
-int readerx_log(char *file, const char *func, int line, char *fmt, ...);
 #endif
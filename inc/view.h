@@ -3,25 +3,122 @@
 
 #include <cairo/cairo.h>
 #include <cairo/cairo-xlib.h>
+#include <X11/extensions/XShm.h>
 
 #include "common.h"
+#include "cache.h"
+#include "render.h"
+#include "profiler.h"
+#include "arena.h"
+#include "pages.h"
+#include "queue.h"
+#include "search.h"
 #include <X11/Xutil.h>
 
+/* Profiler overlay in the top left corner of the window */
+#define HUD_X           8
+#define HUD_Y           8
+#define HUD_WIDTH       320
+#define HUD_LINE_HEIGHT 14
+#define HUD_HEIGHT      ((STAGE_COUNT + COUNTER_COUNT + 3) * HUD_LINE_HEIGHT)
+
+/* Placeholder and selection colours of the page overview */
+#define PLACEHOLDER_GRAY    0.85
+#define SELECTION_WIDTH     3
+
+/* Search highlights drawn over a page, more are left out */
+#define HIGHLIGHT_MAX   1024
+
+struct view;
+
+// A backend provides the surface frames are composed in and presents it
 typedef struct {
-  queue_t *scene_queue;
-  queue_t *surface_queue;
-  queue_t *cairo_queue;
-} history_t;
+  char *name;
+  int (*create)(struct view *view);
+  void (*destroy)(struct view *view);
+  void (*scroll)(struct view *view, dim_t scroll);
+  void (*present)(struct view *view);
+} backend_t;
 
+// Scenes are composed off screen and presented in one copy. With MIT-SHM
+// the backbuffer is a shared memory image, otherwise a server Pixmap,
+// without a display an image surface.
 typedef struct {
+  backend_t *backend;
+  char *fallback;
+  XShmSegmentInfo segment;
+  XImage *image;
+  Pixmap pixmap;
+  cairo_surface_t *surface;
+  cairo_t *cairo;
+  GC gc;
+  dim_t size;
+  long allocations;
+  long blit_bytes;
+  long blit_time;
+  long present_bytes;
+  long present_time;
+} backbuffer_t;
+
+typedef struct view {
   common_t *common;
   XTextProperty window_title;
   XWMHints *wmhints;
-  history_t history;
-  queue_t *scene_queue;
+  char title[TITLE_MAX];
+  frame_t *frame;
+  scene_t **scenes;
+  int scene_capacity;
+  PopplerDocument *doc;
+  page_handles_t *pages;
+  backbuffer_t backbuffer;
+  cache_t *cache;
+  render_pool_t *pool;
+  disk_cache_t *disk_cache;
+  GHashTable *in_flight;
+  int generation;
+  int redraw;
+  long wakeups;
+  long wakeup_latency;
+  long max_wakeup_latency;
+  long full_frames;
+  long scroll_frames;
+  long render_time;
+  cairo_surface_t *hud_under;
+  int hud_drawn;
+  histogram_t hud_stages[STAGE_COUNT];
+  histogram_t hud_counters[COUNTER_COUNT];
+  hit_t *highlights;
+  scene_t *placeholders;
+  int num_of_placeholders;
+  int placeholder_capacity;
+  int selected;
+  long thumbnails_filled;
 } view_t;
 
 void update_title(view_t *view);
+void free_backbuffer(view_t *view);
+void resize_backbuffer(view_t *view);
+void scroll_backbuffer(view_t *view, dim_t scroll);
+int get_damage(view_t *view, XRectangle *damage);
+void present_backbuffer(view_t *view);
+void blit_surface(view_t *view, cairo_surface_t *surface, int x, int y);
+void render_strip(view_t *view, scene_t *scene);
+void request_surface(view_t *view, cache_key_t *key, render_priority_t priority);
+void store_surface(view_t *view, render_job_t *job);
+cairo_surface_t *wait_for_surface(view_t *view, cache_key_t *key);
+int is_tiled_scene(scene_t *scene);
+int get_tile_range(scene_t *scene, XRectangle *rect, dim_t *first, dim_t *last);
+void request_tiles(view_t *view, scene_t *scene, XRectangle *rect, render_priority_t priority);
+void draw_tiles(view_t *view, scene_t *scene, XRectangle *rect);
+void draw_highlights(view_t *view, scene_t *scene);
+cache_key_t get_thumbnail_key(scene_t *scene);
+void draw_placeholder(view_t *view, scene_t *scene);
+void draw_selection(view_t *view, scene_t *scene);
+void display_overview(view_t *view, scene_t **scenes, int num_of_scenes);
+void fill_placeholders(view_t *view);
+void restore_hud(view_t *view);
+void draw_hud(view_t *view);
+int dequeue_scenes(view_t *view);
 void display_scene(view_t *view);
 
 #endif
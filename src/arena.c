@@ -0,0 +1,77 @@
+#include <stdlib.h>
+
+#include "arena.h"
+
+static arena_chunk_t *new_chunk(arena_t *arena, size_t size, arena_chunk_t *next)
+{
+  arena_chunk_t *chunk = malloc(sizeof(arena_chunk_t) + size);
+
+  chunk->next = next;
+  chunk->size = size;
+  chunk->used = 0;
+  arena->allocations++;
+
+  return chunk;
+}
+
+arena_t *init_arena(size_t size)
+{
+  arena_t *arena = malloc(sizeof(arena_t));
+
+  arena->allocations = 0;
+  arena->head = new_chunk(arena, size, NULL);
+
+  return arena;
+}
+
+static void free_chunks(arena_chunk_t *chunk)
+{
+  arena_chunk_t *next;
+
+  for (; chunk; chunk = next) {
+    next = chunk->next;
+    free(chunk);
+  }
+}
+
+void deinit_arena(arena_t *arena)
+{
+  free_chunks(arena->head);
+  free(arena);
+}
+
+void *arena_alloc(arena_t *arena, size_t size)
+{
+  arena_chunk_t *chunk = arena->head;
+  void *data;
+
+  size = (size + ARENA_ALIGNMENT - 1) & ~(size_t) (ARENA_ALIGNMENT - 1);
+
+  // Chain a chunk at least twice as large when the current one is full
+  if (chunk->used + size > chunk->size)
+    chunk = arena->head = new_chunk(arena, 2 * chunk->size > size ? 2 * chunk->size : size, chunk);
+
+  data = chunk->data + chunk->used;
+  chunk->used += size;
+
+  return data;
+}
+
+// Frames that needed more than one chunk leave a single chunk large
+// enough for all of them behind
+void reset_arena(arena_t *arena)
+{
+  arena_chunk_t *chunk;
+  size_t size = 0;
+
+  if (!arena->head->next) {
+    arena->head->used = 0;
+    return;
+  }
+
+  for (chunk = arena->head; chunk; chunk = chunk->next)
+    size += chunk->size;
+
+  free_chunks(arena->head);
+  arena->head = new_chunk(arena, size, NULL);
+}
@@ -0,0 +1,191 @@
+#include <sys/ipc.h>
+#include <sys/shm.h>
+
+#include "backend.h"
+#include "util.h"
+
+// Shift an image in client memory by the scroll distance
+static void scroll_image(cairo_surface_t *surface, dim_t size, dim_t scroll)
+{
+  unsigned char *data = cairo_image_surface_get_data(surface);
+  int stride = cairo_image_surface_get_stride(surface);
+  int y;
+
+  if (scroll.y > 0)
+    memmove(data + scroll.y * stride, data, (size.y - scroll.y) * stride);
+  if (scroll.y < 0)
+    memmove(data, data - scroll.y * stride, (size.y + scroll.y) * stride);
+
+  for (y = 0; scroll.x && y < size.y; y++)
+    if (scroll.x > 0)
+      memmove(data + y * stride + scroll.x * 4, data + y * stride, (size.x - scroll.x) * 4);
+    else
+      memmove(data + y * stride, data + y * stride - scroll.x * 4, (size.x + scroll.x) * 4);
+}
+
+// MIT-SHM backend, the backbuffer is a shared memory image
+static int shm_error;
+
+static int handle_shm_error(Display *display, XErrorEvent *error)
+{
+  shm_error = 1;
+  return 0;
+}
+
+// Attaching fails on remote displays even if the extension is there
+static int create_shm(view_t *view)
+{
+  backbuffer_t *backbuffer = &view->backbuffer;
+  common_t *common = view->common;
+  int (*handler)(Display *, XErrorEvent *);
+
+  backbuffer->image = XShmCreateImage(common->display, DefaultVisualOfScreen(common->screen),
+      DefaultDepthOfScreen(common->screen), ZPixmap, NULL, &backbuffer->segment,
+      backbuffer->size.x, backbuffer->size.y);
+  // The pixels are written as CAIRO_FORMAT_RGB24
+  if (!backbuffer->image || backbuffer->image->bits_per_pixel != 32
+      || backbuffer->image->red_mask != 0xff0000 || backbuffer->image->green_mask != 0xff00
+      || backbuffer->image->blue_mask != 0xff) {
+    backbuffer->fallback = "unsupported visual";
+    if (backbuffer->image)
+      XDestroyImage(backbuffer->image);
+    backbuffer->image = NULL;
+    return 0;
+  }
+
+  backbuffer->segment.shmid = shmget(IPC_PRIVATE,
+      backbuffer->image->bytes_per_line * backbuffer->size.y, IPC_CREAT | 0600);
+  if (backbuffer->segment.shmid < 0) {
+    backbuffer->fallback = "no shared memory segment";
+    XDestroyImage(backbuffer->image);
+    backbuffer->image = NULL;
+    return 0;
+  }
+  backbuffer->segment.shmaddr = shmat(backbuffer->segment.shmid, NULL, 0);
+  if (backbuffer->segment.shmaddr == (void *) -1) {
+    backbuffer->fallback = "no shared memory segment";
+    shmctl(backbuffer->segment.shmid, IPC_RMID, NULL);
+    XDestroyImage(backbuffer->image);
+    backbuffer->image = NULL;
+    return 0;
+  }
+  backbuffer->image->data = backbuffer->segment.shmaddr;
+  backbuffer->segment.readOnly = False;
+
+  shm_error = 0;
+  handler = XSetErrorHandler(handle_shm_error);
+  XShmAttach(common->display, &backbuffer->segment);
+  XSync(common->display, False);
+  XSetErrorHandler(handler);
+
+  // The segment goes away once both sides detach
+  shmctl(backbuffer->segment.shmid, IPC_RMID, NULL);
+
+  if (shm_error) {
+    backbuffer->fallback = "attach failed";
+    shmdt(backbuffer->segment.shmaddr);
+    backbuffer->image->data = NULL;
+    XDestroyImage(backbuffer->image);
+    backbuffer->image = NULL;
+    return 0;
+  }
+
+  backbuffer->surface = cairo_image_surface_create_for_data((unsigned char *) backbuffer->image->data,
+      CAIRO_FORMAT_RGB24, backbuffer->size.x, backbuffer->size.y, backbuffer->image->bytes_per_line);
+  return 1;
+}
+
+static void destroy_shm(view_t *view)
+{
+  backbuffer_t *backbuffer = &view->backbuffer;
+
+  cairo_surface_destroy(backbuffer->surface);
+  XShmDetach(view->common->display, &backbuffer->segment);
+  shmdt(backbuffer->segment.shmaddr);
+  backbuffer->image->data = NULL;
+  XDestroyImage(backbuffer->image);
+  backbuffer->image = NULL;
+}
+
+static void scroll_shm(view_t *view, dim_t scroll)
+{
+  scroll_image(view->backbuffer.surface, view->backbuffer.size, scroll);
+}
+
+static void present_shm(view_t *view)
+{
+  backbuffer_t *backbuffer = &view->backbuffer;
+
+  XShmPutImage(view->common->display, view->common->drawable, backbuffer->gc, backbuffer->image,
+      0, 0, 0, 0, backbuffer->size.x, backbuffer->size.y, False);
+
+  // The shared image must not change before the server has read it
+  XSync(view->common->display, False);
+}
+
+backend_t shm_backend = { "MIT-SHM", create_shm, destroy_shm, scroll_shm, present_shm };
+
+// Xlib backend, the backbuffer is a server Pixmap
+static int create_pixmap(view_t *view)
+{
+  backbuffer_t *backbuffer = &view->backbuffer;
+  common_t *common = view->common;
+
+  backbuffer->pixmap = XCreatePixmap(common->display, common->drawable,
+      backbuffer->size.x, backbuffer->size.y, DefaultDepthOfScreen(common->screen));
+  backbuffer->surface = cairo_xlib_surface_create(common->display, backbuffer->pixmap,
+      DefaultVisualOfScreen(common->screen), backbuffer->size.x, backbuffer->size.y);
+  return 1;
+}
+
+static void destroy_pixmap(view_t *view)
+{
+  cairo_surface_destroy(view->backbuffer.surface);
+  XFreePixmap(view->common->display, view->backbuffer.pixmap);
+}
+
+static void scroll_pixmap(view_t *view, dim_t scroll)
+{
+  backbuffer_t *backbuffer = &view->backbuffer;
+  dim_t size = backbuffer->size;
+
+  XCopyArea(view->common->display, backbuffer->pixmap, backbuffer->pixmap, backbuffer->gc,
+      MAX(0, -scroll.x), MAX(0, -scroll.y), size.x - abs(scroll.x), size.y - abs(scroll.y),
+      MAX(0, scroll.x), MAX(0, scroll.y));
+}
+
+static void present_pixmap(view_t *view)
+{
+  backbuffer_t *backbuffer = &view->backbuffer;
+
+  XCopyArea(view->common->display, backbuffer->pixmap, view->common->drawable,
+      backbuffer->gc, 0, 0, backbuffer->size.x, backbuffer->size.y, 0, 0);
+  XFlush(view->common->display);
+}
+
+backend_t pixmap_backend = { "Xlib", create_pixmap, destroy_pixmap, scroll_pixmap, present_pixmap };
+
+// Offscreen backend, frames stay in an image surface without a display
+static int create_offscreen(view_t *view)
+{
+  view->backbuffer.surface = cairo_image_surface_create(CAIRO_FORMAT_RGB24,
+      view->backbuffer.size.x, view->backbuffer.size.y);
+  return 1;
+}
+
+static void destroy_offscreen(view_t *view)
+{
+  cairo_surface_destroy(view->backbuffer.surface);
+}
+
+static void scroll_offscreen(view_t *view, dim_t scroll)
+{
+  scroll_image(view->backbuffer.surface, view->backbuffer.size, scroll);
+}
+
+static void present_offscreen(view_t *view)
+{
+}
+
+backend_t offscreen_backend = { "offscreen", create_offscreen, destroy_offscreen,
+  scroll_offscreen, present_offscreen };
@@ -0,0 +1,163 @@
+#include "cache.h"
+#include "util.h"
+
+guint hash_cache_key(gconstpointer data)
+{
+  const cache_key_t *key = data;
+
+  return (((guint) key->page_no * 31 + (guint) (key->scaling * 1000)) * 31
+      + (guint) key->tile.x) * 31 + (guint) key->tile.y;
+}
+
+gboolean equal_cache_keys(gconstpointer a, gconstpointer b)
+{
+  const cache_key_t *key_a = a, *key_b = b;
+
+  return key_a->page_no == key_b->page_no && key_a->scaling == key_b->scaling
+    && key_a->tile.x == key_b->tile.x && key_a->tile.y == key_b->tile.y;
+}
+
+static void unlink_entry(cache_t *cache, cache_entry_t *entry)
+{
+  if (entry->prev)
+    entry->prev->next = entry->next;
+  else
+    cache->head = entry->next;
+
+  if (entry->next)
+    entry->next->prev = entry->prev;
+  else
+    cache->tail = entry->prev;
+}
+
+static void link_entry(cache_t *cache, cache_entry_t *entry)
+{
+  entry->prev = NULL;
+  entry->next = cache->head;
+
+  if (cache->head)
+    cache->head->prev = entry;
+  else
+    cache->tail = entry;
+  cache->head = entry;
+}
+
+static void remove_entry(cache_t *cache, cache_entry_t *entry)
+{
+  unlink_entry(cache, entry);
+  g_hash_table_remove(cache->table, &entry->key);
+
+  cache->bytes -= entry->bytes;
+  cairo_surface_destroy(entry->surface);
+  free(entry);
+}
+
+cache_t *init_cache(long budget)
+{
+  cache_t *cache = malloc(sizeof(cache_t));
+
+  cache->table = g_hash_table_new(hash_cache_key, equal_cache_keys);
+  cache->head = cache->tail = NULL;
+  cache->budget = budget;
+  cache->bytes = 0;
+  cache->hits = cache->misses = cache->evictions = 0;
+
+  return cache;
+}
+
+void deinit_cache(cache_t *cache)
+{
+  while (cache->head)
+    remove_entry(cache, cache->head);
+
+  g_hash_table_destroy(cache->table);
+  free(cache);
+}
+
+cache_key_t get_cache_key(int page_no, double scaling, int tile_x, int tile_y)
+{
+  cache_key_t key;
+
+  key.page_no = page_no;
+  key.scaling = scaling;
+  key.tile.x = tile_x;
+  key.tile.y = tile_y;
+
+  return key;
+}
+
+// Lookup without touching the hit/miss counters
+cairo_surface_t *peek_cached_surface(cache_t *cache, cache_key_t *key)
+{
+  cache_entry_t *entry = g_hash_table_lookup(cache->table, key);
+
+  if (!entry)
+    return NULL;
+
+  unlink_entry(cache, entry);
+  link_entry(cache, entry);
+
+  return entry->surface;
+}
+
+cairo_surface_t *find_cached_surface(cache_t *cache, cache_key_t *key)
+{
+  cairo_surface_t *surface = peek_cached_surface(cache, key);
+
+  if (surface)
+    cache->hits++;
+  else
+    cache->misses++;
+
+  return surface;
+}
+
+// The cache takes over the reference to the surface
+void cache_surface(cache_t *cache, cache_key_t *key, cairo_surface_t *surface)
+{
+  cache_entry_t *entry = g_hash_table_lookup(cache->table, key);
+
+  if (entry)
+    remove_entry(cache, entry);
+
+  entry = malloc(sizeof(cache_entry_t));
+  entry->key = *key;
+  entry->surface = surface;
+  entry->bytes = (long) cairo_image_surface_get_stride(surface)
+    * cairo_image_surface_get_height(surface);
+
+  // Keep at least the new entry, even if it is over the budget
+  while (cache->head && cache->bytes + entry->bytes > cache->budget) {
+    LOG("Evicting page %d", cache->tail->key.page_no);
+    remove_entry(cache, cache->tail);
+    cache->evictions++;
+  }
+
+  link_entry(cache, entry);
+  g_hash_table_insert(cache->table, &entry->key, entry);
+  cache->bytes += entry->bytes;
+}
+
+// Evicts the least recently used entries until the cache holds at most
+// the given bytes, returns the bytes freed
+long trim_cache(cache_t *cache, long bytes)
+{
+  long freed = 0;
+
+  while (cache->tail && cache->bytes > bytes) {
+    freed += cache->tail->bytes;
+    remove_entry(cache, cache->tail);
+    cache->evictions++;
+  }
+
+  return freed;
+}
+
+void print_cache_stats(cache_t *cache, FILE *stream)
+{
+  long lookups = cache->hits + cache->misses;
+
+  fprintf(stream, "page cache: %ld hits, %ld misses (%.1f%% hit rate), %ld evictions, %ld/%ld KiB\n",
+      cache->hits, cache->misses, lookups ? 100.0 * cache->hits / lookups : 0.0,
+      cache->evictions, cache->bytes / 1024, cache->budget / 1024);
+}
@@ -1,7 +1,10 @@
+#include <poll.h>
+#include <stdint.h>
 #include <X11/Xlib.h>
 #include <X11/Xutil.h>
 
 #include "controller.h"
+#include "profiler.h"
 #include "util.h"
 
 void *init_controller(common_t *common)
@@ -9,11 +12,20 @@ void *init_controller(common_t *common)
   controller_t *controller = malloc(sizeof(controller_t));
   controller->common = common;
 
+  // The model has sized the window by now, Expose events keep this
+  // copy current and every event carries it to the model thread
+  controller->window_size = common->window_size;
   controller->input = 0;
   controller->last_input = 0;
   controller->ctrl_active = 0;
   controller->input_active = 0;
   controller->rep = 0;
+  controller->pending.type = Standby;
+  controller->coalesced = 0;
+  controller->x_wakeups = 0;
+  controller->woken = 0;
+  controller->searching = 0;
+  controller->query_length = 0;
 
   XSelectInput(common->display, common->drawable, INPUT_MASK);
 
@@ -26,6 +38,12 @@ void *init_controller(common_t *common)
 void deinit_controller(void *data)
 {
   controller_t *controller = (controller_t *) data;
+  FILE *stats = get_stats_stream();
+
+  if (stats) {
+    fprintf(stats, "main loop: %ld X wakeups\n", controller->x_wakeups);
+    fprintf(stats, "main loop: %ld events coalesced\n", controller->coalesced);
+  }
 
   /*
   XDestroyWindow(controller->common->display, controller->common->drawable);
@@ -44,12 +62,69 @@ void set_window_size(controller_t *controller)
   XWindowAttributes attr;
   XGetWindowAttributes(common->display, common->drawable, &attr);
 
-  if (common->window_size.x != attr.width ||
-      common->window_size.y != attr.height) {
-    common->window_size.x = attr.width;
-    common->window_size.y = attr.height;
-    LOG("Window resized to %d x %d", (int) common->window_size.x, (int) common->window_size.y);
+  if (controller->window_size.x != attr.width ||
+      controller->window_size.y != attr.height) {
+    controller->window_size.x = attr.width;
+    controller->window_size.y = attr.height;
+    LOG("Window resized to %d x %d", controller->window_size.x, controller->window_size.y);
+  }
+}
+
+// Block until X has something for us, render workers wake the view
+// thread and the frame timer the model thread instead
+void wait_for_input(controller_t *controller)
+{
+  Display *dsp = controller->common->display;
+  struct pollfd fds[2];
+  uint64_t count;
+
+  // Events the view thread read into the Xlib queue do not show up on
+  // the connection, its presents ring the input eventfd instead
+  fds[0].fd = ConnectionNumber(dsp);
+  fds[1].fd = controller->common->input_fd;
+  fds[0].events = fds[1].events = POLLIN;
+
+  while (1) {
+    if (poll(fds, 2, -1) <= 0)
+      continue;
+    if (fds[1].revents & POLLIN)
+      read(fds[1].fd, &count, sizeof(count));
+    if (fds[0].revents & POLLIN || XPending(dsp))
+      break;
+  }
+  controller->woken = g_get_monotonic_time();
+
+  controller->x_wakeups++;
+}
+
+// Keys go to the search prompt, X hands out Latin-1 and the search
+// works on UTF-8
+void edit_query(controller_t *controller, KeySym key, char *text, int length)
+{
+  unsigned char c = length == 1 ? text[0] : 0;
+
+  controller->input_active = 1;
+  controller->input = SEARCH_EDIT;
+
+  if (key == RETURN || key == ESCAPE) {
+    controller->searching = 0;
+    controller->input = key == RETURN && controller->query_length ? SEARCH_DONE : SEARCH_CANCEL;
   }
+  else if (key == BACKSPACE) {
+    while (controller->query_length > 0
+        && (controller->query[--controller->query_length] & 0xC0) == 0x80)
+      ;
+  }
+  else if (c >= 0xA0 && controller->query_length + 2 < QUERY_MAX) {
+    controller->query[controller->query_length++] = 0xC0 | (c >> 6);
+    controller->query[controller->query_length++] = 0x80 | (c & 0x3F);
+  }
+  else if (c >= ' ' && c < 0x7F && controller->query_length + 1 < QUERY_MAX)
+    controller->query[controller->query_length++] = c;
+  else
+    controller->input_active = 0;
+
+  controller->query[controller->query_length] = '\0';
 }
 
 void get_input(controller_t *controller)
@@ -57,10 +132,14 @@ void get_input(controller_t *controller)
   char keybuf[8];
   KeySym key;
   XEvent e;
-  int input = 0;
+  int input = 0, length;
 
   Display *dsp = controller->common->display;
 
+  // Sleep until there is something to do
+  if (!XPending(dsp))
+    wait_for_input(controller);
+
   // Read the input from the user
   if (XPending(dsp)) {
     XNextEvent(dsp, &e);
@@ -71,8 +150,12 @@ void get_input(controller_t *controller)
         input = (int) e.xbutton.button;
         break;
       case KeyPress:
-        XLookupString(&e.xkey, keybuf, sizeof(keybuf), &key, NULL);
+        length = XLookupString(&e.xkey, keybuf, sizeof(keybuf), &key, NULL);
         LOG("KeyPress event received: %ld", key);
+        if (controller->searching) {
+          edit_query(controller, key, keybuf, length);
+          return;
+        }
         input = (int) key;
         if (input == SHIFT_L || input == SHIFT_R)
           return;
@@ -106,7 +189,6 @@ void get_input(controller_t *controller)
       default:
         return;
     }
-    XSync(dsp, 1);
     if (input) {
       controller->input_active = 1;
       controller->input = input;
@@ -120,6 +202,7 @@ void generate_event(controller_t *controller)
 
   controller->event.type = Standby;
   controller->event.rep = 1;
+  controller->event.text = NULL;
 
   if (!controller->input_active)
     return;
@@ -208,6 +291,46 @@ void generate_event(controller_t *controller)
     case EXIT:
       controller->event.type = Exit;
       break;
+    case HUD:
+      controller->event.type = Hud;
+      break;
+    case OVERVIEW:
+      controller->event.type = Overview;
+      break;
+    case LAYOUT:
+      controller->event.type = Layout;
+      controller->event.rep = controller->rep > 0 ? controller->rep : 0;
+      break;
+    case RETURN:
+      controller->event.type = Select;
+      break;
+    case SEARCH_NEXT:
+      controller->event.type = SearchNext;
+      if (controller->rep > 0)
+        controller->event.rep = controller->rep;
+      break;
+    case SEARCH_PREVIOUS:
+      controller->event.type = SearchPrevious;
+      if (controller->rep > 0)
+        controller->event.rep = controller->rep;
+      break;
+    // The prompt is never repeated, its text belongs to the model
+    case SEARCH:
+      controller->searching = 1;
+      controller->query_length = 0;
+      controller->query[0] = '\0';
+      // fall through
+    case SEARCH_EDIT:
+      controller->event.type = SearchPrompt;
+      controller->event.text = strdup(controller->query);
+      return;
+    case SEARCH_DONE:
+      controller->event.type = Search;
+      controller->event.text = strdup(controller->query);
+      return;
+    case SEARCH_CANCEL:
+      controller->event.type = SearchPrompt;
+      return;
     default:
       controller->event.type = Standby;
   }
@@ -217,13 +340,67 @@ void generate_event(controller_t *controller)
   LOG("Received event: %d", controller->event.type);
 }
 
+int is_coalescable(event_type_t type)
+{
+  switch (type) {
+    case ScrollDown:
+    case ScrollUp:
+    case ScrollLeft:
+    case ScrollRight:
+    case ZoomIn:
+    case ZoomOut:
+      return 1;
+    default:
+      return 0;
+  }
+}
+
 event_t controller_main(void *data)
 {
   controller_t *controller = (controller_t *) data;
+  event_t event;
+
+  controller->woken = g_get_monotonic_time();
+
+  // The event that ended the previous batch goes first
+  if (controller->pending.type != Standby) {
+    event = controller->pending;
+    controller->pending.type = Standby;
+  }
+  else {
+    get_input(controller);
+    generate_event(controller);
+    event = controller->event;
+  }
+
+  event.window_size = controller->window_size;
+
+  if (!is_coalescable(event.type)) {
+    if (event.type != Standby)
+      add_sample(controller->common->profiler, INPUT_STAGE, g_get_monotonic_time() - controller->woken);
+    return event;
+  }
+
+  // Drain the X queue, key auto-repeat yields one frame per batch
+  while (XPending(controller->common->display)) {
+    get_input(controller);
+    generate_event(controller);
+
+    if (controller->event.type == Standby)
+      continue;
+
+    if (controller->event.type != event.type) {
+      controller->pending = controller->event;
+      break;
+    }
+
+    event.rep += controller->event.rep;
+    controller->coalesced++;
+  }
 
-  // Get input and generate event
-  get_input(controller);
-  generate_event(controller);
+  if (event.rep > 1)
+    LOG("Coalesced event: %d, rep: %d", event.type, event.rep);
+  add_sample(controller->common->profiler, INPUT_STAGE, g_get_monotonic_time() - controller->woken);
 
-  return controller->event;
+  return event;
 }
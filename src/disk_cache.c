@@ -0,0 +1,276 @@
+#include <sys/stat.h>
+#include <utime.h>
+#include <zlib.h>
+
+#include "disk_cache.h"
+#include "util.h"
+
+typedef struct {
+  char *path;
+  long size;
+  time_t mtime;
+} disk_entry_t;
+
+// Hashing a multi-gigabyte file on every start would cost more than it
+// saves, the size and samples across the file identify it well enough
+char *hash_document(GBytes *document)
+{
+  GChecksum *checksum = g_checksum_new(G_CHECKSUM_SHA1);
+  const guchar *data;
+  gsize size, offset;
+  char *hash;
+  int i;
+
+  data = g_bytes_get_data(document, &size);
+  g_checksum_update(checksum, (const guchar *) &size, sizeof(size));
+  g_checksum_update(checksum, data, MIN(size, HASH_EDGE_SIZE));
+  g_checksum_update(checksum, data + size - MIN(size, HASH_EDGE_SIZE), MIN(size, HASH_EDGE_SIZE));
+
+  for (i = 0; size > HASH_SAMPLE_SIZE && i < HASH_SAMPLES; i++) {
+    offset = (size - HASH_SAMPLE_SIZE) / HASH_SAMPLES * i;
+    g_checksum_update(checksum, data + offset, HASH_SAMPLE_SIZE);
+  }
+
+  hash = strdup(g_checksum_get_string(checksum));
+  g_checksum_free(checksum);
+
+  return hash;
+}
+
+static gpointer run_trimmer(gpointer data)
+{
+  trim_disk_cache((disk_cache_t *) data);
+
+  return NULL;
+}
+
+disk_cache_t *init_disk_cache(GBytes *document, long budget)
+{
+  disk_cache_t *disk_cache;
+  char *dir = g_build_filename(g_get_user_cache_dir(), DISK_CACHE_DIR, NULL);
+
+  if (g_mkdir_with_parents(dir, 0700)) {
+    LOG("Cannot create disk cache %s", dir);
+    g_free(dir);
+    return NULL;
+  }
+
+  disk_cache = malloc(sizeof(disk_cache_t));
+  disk_cache->dir = dir;
+  disk_cache->hash = hash_document(document);
+  disk_cache->budget = budget;
+  disk_cache->bytes = 0;
+  disk_cache->hits = disk_cache->misses = disk_cache->writes = 0;
+  disk_cache->corrupt = disk_cache->evictions = 0;
+  g_mutex_init(&disk_cache->lock);
+  g_mutex_init(&disk_cache->trim_lock);
+
+  // Sizing up the directory should not hold up the first page
+  disk_cache->trimmer = g_thread_new("trimmer", run_trimmer, disk_cache);
+
+  return disk_cache;
+}
+
+void deinit_disk_cache(disk_cache_t *disk_cache)
+{
+  g_thread_join(disk_cache->trimmer);
+  g_mutex_clear(&disk_cache->lock);
+  g_mutex_clear(&disk_cache->trim_lock);
+  g_free(disk_cache->dir);
+  free(disk_cache->hash);
+  free(disk_cache);
+}
+
+char *get_entry_path(disk_cache_t *disk_cache, cache_key_t *key)
+{
+  char name[STR_MAX];
+
+  snprintf(name, STR_MAX, "%s-%d-%ld-%d-%d", disk_cache->hash, key->page_no,
+      lround(key->scaling * 10000), key->tile.x, key->tile.y);
+
+  return g_build_filename(disk_cache->dir, name, NULL);
+}
+
+// Entries that do not decompress to what their header promises are
+// removed, the page is then rendered and stored again
+cairo_surface_t *load_surface(disk_cache_t *disk_cache, cache_key_t *key)
+{
+  cairo_surface_t *surface = NULL;
+  disk_entry_header_t header;
+  unsigned char *compressed = NULL;
+  uLongf length;
+  struct stat info;
+  char *path = get_entry_path(disk_cache, key);
+  FILE *file = fopen(path, "rb");
+
+  if (!file) {
+    g_atomic_int_inc(&disk_cache->misses);
+    g_free(path);
+    return NULL;
+  }
+
+  // The header is not trusted, sizes are bounded by the surface and the file
+  if (fread(&header, sizeof(header), 1, file) == 1 && header.magic == DISK_CACHE_MAGIC
+      && header.width > 0 && header.width <= DISK_ENTRY_MAX_SIDE
+      && header.height > 0 && header.height <= DISK_ENTRY_MAX_SIDE
+      && header.stride == cairo_format_stride_for_width(CAIRO_FORMAT_RGB24, header.width)
+      && header.compressed <= compressBound((uLong) header.stride * header.height)
+      && fstat(fileno(file), &info) == 0
+      && header.compressed <= (uint64_t) info.st_size - sizeof(header)
+      && (compressed = malloc(header.compressed))) {
+    surface = cairo_image_surface_create(CAIRO_FORMAT_RGB24, header.width, header.height);
+    length = (uLongf) header.stride * header.height;
+
+    if (cairo_surface_status(surface) != CAIRO_STATUS_SUCCESS
+        || fread(compressed, 1, header.compressed, file) != header.compressed
+        || uncompress(cairo_image_surface_get_data(surface), &length, compressed, header.compressed) != Z_OK
+        || length != (uLongf) header.stride * header.height) {
+      cairo_surface_destroy(surface);
+      surface = NULL;
+    }
+  }
+  fclose(file);
+  free(compressed);
+
+  if (surface) {
+    cairo_surface_mark_dirty(surface);
+    g_atomic_int_inc(&disk_cache->hits);
+    // Bump the entry in the LRU order
+    utime(path, NULL);
+  }
+  else {
+    LOG("Dropping corrupt disk cache entry %s", path);
+    g_atomic_int_inc(&disk_cache->corrupt);
+    unlink(path);
+  }
+
+  g_free(path);
+  return surface;
+}
+
+// Written to a temporary file and renamed, readers never see a partial entry
+void save_surface(disk_cache_t *disk_cache, cache_key_t *key, cairo_surface_t *surface)
+{
+  disk_entry_header_t header;
+  unsigned char *compressed;
+  uLongf length;
+  char *path, *temp;
+  FILE *file;
+  int written, over_budget = 0;
+
+  cairo_surface_flush(surface);
+  header.magic = DISK_CACHE_MAGIC;
+  header.width = cairo_image_surface_get_width(surface);
+  header.height = cairo_image_surface_get_height(surface);
+  header.stride = cairo_image_surface_get_stride(surface);
+
+  length = compressBound((uLong) header.stride * header.height);
+  compressed = malloc(length);
+  if (compress2(compressed, &length, cairo_image_surface_get_data(surface),
+        (uLong) header.stride * header.height, Z_BEST_SPEED) != Z_OK) {
+    free(compressed);
+    return;
+  }
+  header.compressed = length;
+
+  path = get_entry_path(disk_cache, key);
+  temp = g_strdup_printf("%s.%p.tmp", path, (void *) g_thread_self());
+
+  if ((file = fopen(temp, "wb"))) {
+    written = fwrite(&header, sizeof(header), 1, file) == 1
+      && fwrite(compressed, 1, length, file) == length;
+    if (fclose(file) == 0 && written && rename(temp, path) == 0) {
+      g_atomic_int_inc(&disk_cache->writes);
+      g_mutex_lock(&disk_cache->lock);
+      disk_cache->bytes += sizeof(header) + length;
+      over_budget = disk_cache->bytes > disk_cache->budget;
+      g_mutex_unlock(&disk_cache->lock);
+    }
+    else
+      unlink(temp);
+  }
+
+  free(compressed);
+  g_free(temp);
+  g_free(path);
+
+  if (over_budget)
+    trim_disk_cache(disk_cache);
+}
+
+static int compare_entries(const void *a, const void *b)
+{
+  const disk_entry_t *entry_a = a, *entry_b = b;
+
+  return (entry_a->mtime > entry_b->mtime) - (entry_a->mtime < entry_b->mtime);
+}
+
+// Least recently used entries of any document go first, down to three
+// quarters of the cap so this does not run on every write. Returns at
+// once when another thread is trimming.
+void trim_disk_cache(disk_cache_t *disk_cache)
+{
+  GDir *dir;
+  const char *name;
+  disk_entry_t *entries = NULL;
+  struct stat info;
+  long bytes = 0;
+  int num_of_entries = 0, capacity = 0, i;
+
+  if (!g_mutex_trylock(&disk_cache->trim_lock))
+    return;
+
+  if (!(dir = g_dir_open(disk_cache->dir, 0, NULL))) {
+    g_mutex_unlock(&disk_cache->trim_lock);
+    return;
+  }
+
+  while ((name = g_dir_read_name(dir))) {
+    if (num_of_entries == capacity) {
+      capacity = capacity ? capacity * 2 : 256;
+      entries = realloc(entries, capacity * sizeof(disk_entry_t));
+    }
+    entries[num_of_entries].path = g_build_filename(disk_cache->dir, name, NULL);
+    if (stat(entries[num_of_entries].path, &info) || !S_ISREG(info.st_mode)) {
+      g_free(entries[num_of_entries].path);
+      continue;
+    }
+    entries[num_of_entries].size = info.st_size;
+    entries[num_of_entries].mtime = info.st_mtime;
+    bytes += info.st_size;
+    num_of_entries++;
+  }
+  g_dir_close(dir);
+
+  if (bytes > disk_cache->budget) {
+    qsort(entries, num_of_entries, sizeof(disk_entry_t), compare_entries);
+    for (i = 0; i < num_of_entries && bytes > disk_cache->budget / 4 * 3; i++)
+      if (!unlink(entries[i].path)) {
+        bytes -= entries[i].size;
+        g_atomic_int_inc(&disk_cache->evictions);
+      }
+  }
+  g_mutex_lock(&disk_cache->lock);
+  disk_cache->bytes = bytes;
+  g_mutex_unlock(&disk_cache->lock);
+
+  for (i = 0; i < num_of_entries; i++)
+    g_free(entries[i].path);
+  free(entries);
+
+  g_mutex_unlock(&disk_cache->trim_lock);
+}
+
+void print_disk_cache_stats(disk_cache_t *disk_cache, FILE *stream)
+{
+  long bytes;
+
+  g_mutex_lock(&disk_cache->lock);
+  bytes = disk_cache->bytes;
+  g_mutex_unlock(&disk_cache->lock);
+
+  fprintf(stream, "disk cache: %d hits, %d misses, %d writes, %d corrupt, %d evictions, %ld/%ld MiB\n",
+      g_atomic_int_get(&disk_cache->hits), g_atomic_int_get(&disk_cache->misses),
+      g_atomic_int_get(&disk_cache->writes), g_atomic_int_get(&disk_cache->corrupt),
+      g_atomic_int_get(&disk_cache->evictions), bytes >> 20, disk_cache->budget >> 20);
+}
@@ -0,0 +1,173 @@
+#include "geometry.h"
+#include "util.h"
+
+static fdim_t query_page_dim(PopplerDocument *doc, int page_number)
+{
+  fdim_t page_dim;
+  PopplerPage *page;
+
+  page = poppler_document_get_page(doc, page_number);
+  poppler_page_get_size(page, &page_dim.x, &page_dim.y);
+  g_object_unref(page);
+
+  page_dim.x++;
+  page_dim.y++;
+
+  return page_dim;
+}
+
+// Runs on its own thread with its own document, the model keeps using
+// the index while it is being filled
+static gpointer fill_geometry(gpointer data)
+{
+  geometry_t *geometry = (geometry_t *) data;
+  PopplerDocument *doc;
+  int page_number;
+
+  doc = poppler_document_new_from_bytes(geometry->bytes, NULL, NULL);
+  if (!doc) {
+    LOG("Cannot open document for indexing");
+    return NULL;
+  }
+
+  for (page_number = 0; page_number < geometry->num_of_pages; page_number++) {
+    if (g_atomic_int_get(&geometry->cancel))
+      break;
+
+    geometry->dim[page_number] = query_page_dim(doc, page_number);
+    geometry->position[page_number + 1] = geometry->position[page_number]
+      + geometry->dim[page_number].y;
+    g_atomic_int_set(&geometry->ready, page_number + 1);
+  }
+  LOG("Indexed %d pages", g_atomic_int_get(&geometry->ready));
+
+  g_object_unref(doc);
+  return NULL;
+}
+
+// A dimension table saved by an earlier session skips the indexing
+geometry_t *init_geometry(GBytes *bytes, PopplerDocument *doc, int num_of_pages, fdim_t *dim)
+{
+  int page_number;
+
+  geometry_t *geometry = malloc(sizeof(geometry_t));
+
+  geometry->bytes = g_bytes_ref(bytes);
+  geometry->doc = doc;
+  geometry->num_of_pages = num_of_pages;
+  geometry->dim = malloc(num_of_pages * sizeof(fdim_t));
+  geometry->position = malloc((num_of_pages + 1) * sizeof(double));
+  geometry->position[0] = 0;
+  geometry->ready = 0;
+  geometry->cancel = 0;
+  geometry->thread = NULL;
+
+  if (dim) {
+    geometry->first_dim = dim[0];
+    memcpy(geometry->dim, dim, num_of_pages * sizeof(fdim_t));
+    for (page_number = 0; page_number < num_of_pages; page_number++)
+      geometry->position[page_number + 1] = geometry->position[page_number] + dim[page_number].y;
+    geometry->ready = num_of_pages;
+  }
+  else {
+    geometry->first_dim = query_page_dim(doc, 0);
+    geometry->thread = g_thread_new("geometry", fill_geometry, geometry);
+  }
+
+  return geometry;
+}
+
+void deinit_geometry(geometry_t *geometry)
+{
+  g_atomic_int_set(&geometry->cancel, 1);
+  if (geometry->thread)
+    g_thread_join(geometry->thread);
+
+  g_bytes_unref(geometry->bytes);
+  free(geometry->dim);
+  free(geometry->position);
+  free(geometry);
+}
+
+int is_geometry_ready(geometry_t *geometry)
+{
+  return g_atomic_int_get(&geometry->ready) == geometry->num_of_pages;
+}
+
+// Pages that are not indexed yet are queried from the model's document
+fdim_t get_page_dim(geometry_t *geometry, int page_number)
+{
+  if (page_number < g_atomic_int_get(&geometry->ready))
+    return geometry->dim[page_number];
+
+  return query_page_dim(geometry->doc, page_number);
+}
+
+// Pages that are not indexed yet are as wide as the last indexed page
+// and as high as the indexed ones on average, the first page stands in
+// until there are any. Walking the document here would cost what the
+// background index saves.
+static fdim_t estimate_page_dim(geometry_t *geometry, int ready)
+{
+  fdim_t page_dim;
+
+  if (!ready)
+    return geometry->first_dim;
+
+  page_dim = geometry->dim[ready - 1];
+  page_dim.y = geometry->position[ready] / ready;
+
+  return page_dim;
+}
+
+fdim_t get_estimated_dim(geometry_t *geometry, int page_number)
+{
+  int ready = g_atomic_int_get(&geometry->ready);
+
+  if (page_number < ready)
+    return geometry->dim[page_number];
+
+  return estimate_page_dim(geometry, ready);
+}
+
+double get_page_position(geometry_t *geometry, int page_number)
+{
+  int ready = g_atomic_int_get(&geometry->ready);
+
+  if (page_number <= ready)
+    return geometry->position[page_number];
+
+  return geometry->position[ready] + (page_number - ready) * estimate_page_dim(geometry, ready).y;
+}
+
+double get_total_length(geometry_t *geometry)
+{
+  return get_page_position(geometry, geometry->num_of_pages);
+}
+
+// Page that contains the given position, clamped to the document
+int get_page_at(geometry_t *geometry, double position)
+{
+  int low, high, middle;
+  int ready = g_atomic_int_get(&geometry->ready);
+
+  if (position < 0 || geometry->num_of_pages < 2)
+    return 0;
+
+  if (ready > 0 && position < geometry->position[ready]) {
+    low = 0;
+    high = ready - 1;
+    while (low < high) {
+      middle = (low + high + 1) / 2;
+      if (geometry->position[middle] <= position)
+        low = middle;
+      else
+        high = middle - 1;
+    }
+    return low;
+  }
+
+  position = (position - geometry->position[ready]) / estimate_page_dim(geometry, ready).y;
+
+  return MIN(ready + (int) position, geometry->num_of_pages - 1);
+}
@@ -0,0 +1,142 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "governor.h"
+#include "util.h"
+
+governor_t *init_governor(long budget)
+{
+  governor_t *governor = malloc(sizeof(governor_t));
+
+  governor->num_of_caches = 0;
+  governor->budget = budget;
+  governor->last_check = 0;
+  governor->checks = governor->over_budget = governor->pressure_events = 0;
+  governor->evicted = governor->peak_rss = 0;
+  governor->psi_error = NULL;
+
+  // The kernel signals the trigger with POLLPRI, older kernels and some
+  // containers have no PSI
+  governor->psi_fd = open("/proc/pressure/memory", O_RDWR | O_NONBLOCK | O_CLOEXEC);
+  if (governor->psi_fd < 0)
+    governor->psi_error = strerror(errno);
+  else if (write(governor->psi_fd, PSI_TRIGGER, strlen(PSI_TRIGGER) + 1) < 0) {
+    governor->psi_error = strerror(errno);
+    close(governor->psi_fd);
+    governor->psi_fd = -1;
+  }
+
+  return governor;
+}
+
+// Only once the threads are done, the registered caches are still alive
+void deinit_governor(governor_t *governor)
+{
+  if (!governor)
+    return;
+
+  if (get_stats_stream())
+    print_governor_stats(governor, get_stats_stream());
+
+  if (governor->psi_fd >= 0)
+    close(governor->psi_fd);
+  free(governor);
+}
+
+// A missing governor makes this a no-op
+void register_cache(governor_t *governor, const char *name, void *data,
+    long (*get_bytes)(void *data), long (*evict)(void *data, long bytes))
+{
+  if (!governor || governor->num_of_caches == GOVERNOR_MAX_CACHES)
+    return;
+
+  governor->caches[governor->num_of_caches++] = (governed_cache_t) { name, data, get_bytes, evict, 0 };
+}
+
+static long get_evictable_bytes(governor_t *governor)
+{
+  long bytes = 0;
+  int i;
+
+  for (i = 0; i < governor->num_of_caches; i++)
+    if (governor->caches[i].evict)
+      bytes += governor->caches[i].get_bytes(governor->caches[i].data);
+
+  return bytes;
+}
+
+// Frees memory when RSS is over the budget or the kernel reports memory
+// pressure, largest cache first. Under pressure the caches give up half
+// of what they hold. Returns the bytes freed.
+long govern(governor_t *governor, int pressure)
+{
+  governed_cache_t *cache, *largest;
+  long now = g_get_monotonic_time(), rss, excess = 0, freed = 0, bytes, most, evicted;
+  int i;
+
+  if (!governor || (!pressure && now - governor->last_check < GOVERNOR_INTERVAL))
+    return 0;
+  governor->last_check = now;
+  governor->checks++;
+
+  rss = get_rss();
+  if (rss > governor->peak_rss)
+    governor->peak_rss = rss;
+  if (governor->budget && rss > governor->budget) {
+    excess = rss - governor->budget;
+    governor->over_budget++;
+  }
+  if (pressure) {
+    excess = MAX(excess, get_evictable_bytes(governor) / 2);
+    governor->pressure_events++;
+  }
+
+  while (freed < excess) {
+    largest = NULL;
+    most = 0;
+    for (i = 0; i < governor->num_of_caches; i++) {
+      cache = &governor->caches[i];
+      if (cache->evict && (bytes = cache->get_bytes(cache->data)) > most) {
+        largest = cache;
+        most = bytes;
+      }
+    }
+
+    // The rest is not ours to free
+    if (!largest || (evicted = largest->evict(largest->data, excess - freed)) <= 0)
+      break;
+
+    largest->evicted += evicted;
+    freed += evicted;
+  }
+
+  governor->evicted += freed;
+  return freed;
+}
+
+void print_governor_stats(governor_t *governor, FILE *stream)
+{
+  governed_cache_t *cache;
+  int i;
+
+  if (governor->budget)
+    fprintf(stream, "memory: budget %ld MiB, ", governor->budget >> 20);
+  else
+    fprintf(stream, "memory: no budget, ");
+  fprintf(stream, "peak rss %ld MiB, %ld checks, %ld over budget, %ld pressure events, %ld KiB evicted\n",
+      governor->peak_rss >> 20, governor->checks, governor->over_budget,
+      governor->pressure_events, governor->evicted >> 10);
+
+  for (i = 0; i < governor->num_of_caches; i++) {
+    cache = &governor->caches[i];
+    fprintf(stream, "memory: %-12s %8ld KiB", cache->name, cache->get_bytes(cache->data) >> 10);
+    if (cache->evict)
+      fprintf(stream, ", %ld KiB evicted", cache->evicted >> 10);
+    fprintf(stream, "\n");
+  }
+
+  if (governor->psi_fd < 0)
+    fprintf(stream, "memory: no pressure notifications, %s\n", governor->psi_error);
+}
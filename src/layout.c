@@ -0,0 +1,156 @@
+#include "layout.h"
+#include "util.h"
+
+layout_t *init_layout(geometry_t *geometry, int columns, int cover)
+{
+  layout_t *layout = malloc(sizeof(layout_t));
+
+  layout->geometry = geometry;
+  layout->dim = malloc(geometry->num_of_pages * sizeof(fdim_t));
+  layout->position = malloc((geometry->num_of_pages + 1) * sizeof(double));
+  set_layout(layout, columns, cover);
+
+  return layout;
+}
+
+void deinit_layout(layout_t *layout)
+{
+  free(layout->dim);
+  free(layout->position);
+  free(layout);
+}
+
+// A single column has no cover row, its rows are the pages
+void set_layout(layout_t *layout, int columns, int cover)
+{
+  int num_of_pages = layout->geometry->num_of_pages;
+
+  layout->columns = MAX(columns, 1);
+  layout->cover = cover && layout->columns > 1;
+  if (layout->cover)
+    layout->num_of_rows = 1 + (num_of_pages - 1 + layout->columns - 1) / layout->columns;
+  else
+    layout->num_of_rows = (num_of_pages + layout->columns - 1) / layout->columns;
+
+  layout->built = 0;
+  layout->estimated = layout->num_of_rows;
+  layout->position[0] = 0;
+}
+
+int get_row(layout_t *layout, int page_number)
+{
+  if (layout->cover)
+    return page_number == 0 ? 0 : 1 + (page_number - 1) / layout->columns;
+
+  return page_number / layout->columns;
+}
+
+int get_row_start(layout_t *layout, int row)
+{
+  if (layout->cover)
+    return row == 0 ? 0 : 1 + (row - 1) * layout->columns;
+
+  return row * layout->columns;
+}
+
+// One past the last page of the row
+int get_row_end(layout_t *layout, int row)
+{
+  return MIN(get_row_start(layout, row + 1), layout->geometry->num_of_pages);
+}
+
+// Estimated rows are dropped once the real dimensions are known
+static void refresh_rows(layout_t *layout)
+{
+  if (layout->estimated < layout->num_of_rows && is_geometry_ready(layout->geometry)) {
+    layout->built = MIN(layout->built, layout->estimated);
+    layout->estimated = layout->num_of_rows;
+  }
+}
+
+// Rows are measured in order up to the given one, the dimensions come
+// from the geometry index or are estimated while it is being filled
+static void build_rows(layout_t *layout, int row)
+{
+  fdim_t dim, page_dim;
+  int page_number, start;
+
+  refresh_rows(layout);
+  for (; layout->built <= row && layout->built < layout->num_of_rows; layout->built++) {
+    start = get_row_start(layout, layout->built);
+    dim.x = dim.y = 0;
+    if (!is_geometry_ready(layout->geometry)
+        && get_row_end(layout, layout->built) > g_atomic_int_get(&layout->geometry->ready))
+      layout->estimated = MIN(layout->estimated, layout->built);
+    for (page_number = start; page_number < get_row_end(layout, layout->built); page_number++) {
+      page_dim = get_estimated_dim(layout->geometry, page_number);
+      dim.x += page_dim.x + (page_number > start ? LAYOUT_GAP : 0);
+      dim.y = MAX(dim.y, page_dim.y);
+    }
+
+    layout->dim[layout->built] = dim;
+    layout->position[layout->built + 1] = layout->position[layout->built] + dim.y;
+  }
+}
+
+fdim_t get_row_dim(layout_t *layout, int row)
+{
+  build_rows(layout, row);
+  return layout->dim[row];
+}
+
+// Top of a row, the number of rows gives the end of the layout
+double get_row_position(layout_t *layout, int row)
+{
+  build_rows(layout, row - 1);
+  return layout->position[row];
+}
+
+double get_layout_length(layout_t *layout)
+{
+  return get_row_position(layout, layout->num_of_rows);
+}
+
+// Row that contains the given position, clamped to the layout
+int get_row_at(layout_t *layout, double position)
+{
+  int low, high, middle;
+
+  if (position < 0 || layout->num_of_rows < 2)
+    return 0;
+
+  refresh_rows(layout);
+  while (layout->built < layout->num_of_rows && layout->position[layout->built] <= position)
+    build_rows(layout, layout->built);
+
+  low = 0;
+  high = layout->built - 1;
+  while (low < high) {
+    middle = (low + high + 1) / 2;
+    if (layout->position[middle] <= position)
+      low = middle;
+    else
+      high = middle - 1;
+  }
+
+  return low;
+}
+
+// Left edge of a page in its row
+double get_page_x(layout_t *layout, int page_number)
+{
+  double x = 0;
+  int previous;
+
+  for (previous = get_row_start(layout, get_row(layout, page_number)); previous < page_number; previous++)
+    x += get_estimated_dim(layout->geometry, previous).x + LAYOUT_GAP;
+
+  return x;
+}
+
+// Pages smaller than their row are centered on it
+double get_page_y(layout_t *layout, int page_number)
+{
+  return (get_row_dim(layout, get_row(layout, page_number)).y
+      - get_estimated_dim(layout->geometry, page_number).y) / 2;
+}
@@ -0,0 +1,241 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+
+#include "log.h"
+
+static logger_t *logger;
+
+// Split a conversion specification off the format, returns its length
+static int get_spec(const char *fmt, char *spec, int *is_long)
+{
+  int length = 1;
+
+  *is_long = 0;
+  while (fmt[length] && strchr("-+ #0123456789.", fmt[length]))
+    length++;
+  while (fmt[length] && strchr("hlzjt", fmt[length])) {
+    if (fmt[length] != 'h')
+      *is_long = 1;
+    length++;
+  }
+  if (fmt[length])
+    length++;
+
+  memcpy(spec, fmt, MIN(length, 15));
+  spec[MIN(length, 15)] = '\0';
+
+  return length;
+}
+
+static void write_record(log_record_t *record, FILE *file)
+{
+  const char *fmt = record->fmt;
+  char spec[16], stamp[32];
+  time_t seconds = record->timestamp / 1000000;
+  int length, is_long, arg = 0;
+  log_arg_t value;
+
+  strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", localtime(&seconds));
+  fprintf(file, "%s.%06ld at %s (%s:%d) :", stamp, record->timestamp % 1000000,
+      record->func, record->file, record->line);
+
+  while (*fmt) {
+    if (*fmt != '%') {
+      fputc(*fmt++, file);
+      continue;
+    }
+    if (fmt[1] == '%') {
+      fputc('%', file);
+      fmt += 2;
+      continue;
+    }
+
+    length = get_spec(fmt, spec, &is_long);
+    fmt += length;
+    if (arg >= record->num_of_args) {
+      fputs(spec, file);
+      continue;
+    }
+
+    value = record->args[arg++];
+    switch (spec[strlen(spec) - 1]) {
+      case 'f': case 'F': case 'e': case 'E': case 'g': case 'G':
+        fprintf(file, spec, value.f);
+        break;
+      case 's':
+        fprintf(file, spec, record->strings + value.i);
+        break;
+      case 'p':
+        fprintf(file, spec, value.p);
+        break;
+      default:
+        if (is_long)
+          fprintf(file, spec, value.i);
+        else
+          fprintf(file, spec, (int) value.i);
+    }
+  }
+  fputc('\n', file);
+}
+
+// Write out everything published so far, only the logger thread and the
+// exit handler consume records
+static void drain_log(void)
+{
+  log_record_t *record;
+  int tail;
+
+  while (1) {
+    tail = g_atomic_int_get(&logger->tail);
+    record = &logger->records[tail & (LOG_RING_SIZE - 1)];
+    if (g_atomic_int_get(&record->sequence) != tail + 1)
+      break;
+
+    write_record(record, logger->file);
+    g_atomic_int_inc(&logger->tail);
+  }
+  fflush(logger->file);
+}
+
+static gpointer run_logger(gpointer data)
+{
+  g_mutex_lock(&logger->lock);
+  while (!logger->quit) {
+    g_cond_wait_until(&logger->cond, &logger->lock, g_get_monotonic_time() + LOG_FLUSH_PERIOD);
+    g_mutex_unlock(&logger->lock);
+    drain_log();
+    g_mutex_lock(&logger->lock);
+  }
+  g_mutex_unlock(&logger->lock);
+
+  return NULL;
+}
+
+void flush_log(void)
+{
+  if (!logger)
+    return;
+
+  g_mutex_lock(&logger->lock);
+  logger->quit = 1;
+  g_cond_signal(&logger->cond);
+  g_mutex_unlock(&logger->lock);
+  g_thread_join(logger->thread);
+
+  drain_log();
+  if (g_atomic_int_get(&logger->dropped))
+    fprintf(logger->file, "%d log records dropped\n", g_atomic_int_get(&logger->dropped));
+  fclose(logger->file);
+}
+
+static void init_logger(void)
+{
+  static gsize once;
+  FILE *file;
+
+  if (!g_once_init_enter(&once))
+    return;
+
+  if ((file = fopen(LOG_FILEPATH, "a"))) {
+    logger = calloc(1, sizeof(logger_t));
+    logger->file = file;
+    g_mutex_init(&logger->lock);
+    g_cond_init(&logger->cond);
+    logger->thread = g_thread_new("logger", run_logger, NULL);
+    atexit(flush_log);
+  }
+
+  g_once_init_leave(&once, 1);
+}
+
+// Modules are named after their source file, "src/view.c" is "view"
+int get_log_state(const char *file)
+{
+  char *modules = getenv("READERX_LOG"), *list, *module, *save;
+  const char *name = strrchr(file, '/') ? strrchr(file, '/') + 1 : file;
+  int length = strchr(name, '.') ? strchr(name, '.') - name : strlen(name);
+  int state = LOG_OFF;
+
+  if (!modules)
+    return LOG_OFF;
+
+  list = strdup(modules);
+  for (module = strtok_r(list, ",", &save); module; module = strtok_r(NULL, ",", &save))
+    if (!strcmp(module, "all") || (strlen(module) == length && !strncmp(module, name, length)))
+      state = LOG_ON;
+  free(list);
+
+  if (state == LOG_ON)
+    init_logger();
+
+  return logger ? state : LOG_OFF;
+}
+
+int readerx_log(const char *file, const char *func, int line, const char *fmt, ...)
+{
+  log_record_t *record;
+  const char *string;
+  char spec[16];
+  int head, length, is_long, used = 0;
+  va_list ap;
+
+  // Claim a slot, records are dropped rather than waiting for the flush
+  do {
+    head = g_atomic_int_get(&logger->head);
+    if (head - g_atomic_int_get(&logger->tail) >= LOG_RING_SIZE) {
+      g_atomic_int_inc(&logger->dropped);
+      return -1;
+    }
+  } while (!g_atomic_int_compare_and_exchange(&logger->head, head, head + 1));
+
+  record = &logger->records[head & (LOG_RING_SIZE - 1)];
+  record->timestamp = g_get_real_time();
+  record->file = file;
+  record->func = func;
+  record->line = line;
+  record->fmt = fmt;
+  record->num_of_args = 0;
+
+  va_start(ap, fmt);
+  while ((fmt = strchr(fmt, '%')) && record->num_of_args < LOG_MAX_ARGS) {
+    if (fmt[1] == '%') {
+      fmt += 2;
+      continue;
+    }
+
+    length = get_spec(fmt, spec, &is_long);
+    fmt += length;
+    switch (spec[strlen(spec) - 1]) {
+      case 'f': case 'F': case 'e': case 'E': case 'g': case 'G':
+        record->args[record->num_of_args++].f = va_arg(ap, double);
+        break;
+      case 's':
+        // Printed like vfprintf does
+        if (!(string = va_arg(ap, const char *)))
+          string = "(null)";
+        record->args[record->num_of_args++].i = used;
+        length = MIN((int) strlen(string), LOG_STRING_SPACE - used - 1);
+        memcpy(record->strings + used, string, length);
+        record->strings[used + length] = '\0';
+        used += length + (used + length < LOG_STRING_SPACE - 1);
+        break;
+      case 'p':
+        record->args[record->num_of_args++].p = va_arg(ap, void *);
+        break;
+      default:
+        if (is_long)
+          record->args[record->num_of_args++].i = va_arg(ap, long);
+        else
+          record->args[record->num_of_args++].i = va_arg(ap, int);
+    }
+  }
+  va_end(ap);
+
+  // Publish, the consumer expects the slot index plus one
+  g_atomic_int_set(&record->sequence, head + 1);
+
+  return 0;
+}
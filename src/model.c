@@ -1,6 +1,23 @@
+#include "governor.h"
 #include "model.h"
+#include "profiler.h"
 #include "util.h"
 
+static long get_text_bytes(void *data)
+{
+  return get_search_bytes((search_t *) data);
+}
+
+static long get_geometry_bytes(void *data)
+{
+  return ((geometry_t *) data)->num_of_pages * (sizeof(fdim_t) + sizeof(double));
+}
+
+static long get_layout_bytes(void *data)
+{
+  return ((layout_t *) data)->geometry->num_of_pages * (sizeof(fdim_t) + sizeof(double));
+}
+
 int get_scaling_index(int page_height, int screen_height)
 {
   int index = 0;
@@ -18,101 +35,243 @@ int get_scaling_index(int page_height, int screen_height)
 void *init_model(common_t *common)
 {
   scene_t *scn;
-  GError **gerror;
-  PopplerPage *first_page;
+  sidecar_t *sidecar = NULL;
+  GError *error = NULL;
+  long start = g_get_monotonic_time();
 
   model_t *model = malloc(sizeof(model_t));
   model->common = common;
 
-  model->doc = poppler_document_new_from_file(common->input_file, NULL, gerror);
+  model->stamped = !stamp_document(common->input_file, &model->mtime, &model->size);
+
+  // The mapping is shared with the geometry index and the render pool
+  common->document = map_document(common->input_file);
+  if (!common->document) {
+    LOG("Cannot map file %s", common->input_file);
+    return NULL;
+  }
+
+  model->doc = poppler_document_new_from_bytes(common->document, NULL, &error);
   if (!model->doc) {
-    LOG("Cannot open file %s", common->input_file);
+    LOG("Cannot open file %s: %s", common->input_file, error ? error->message : "");
+    if (error)
+      g_error_free(error);
     return NULL;
   }
 
   model->num_of_pages = poppler_document_get_n_pages(model->doc);
 
-  // Always start with the first page
-  model->page.number = 0;
-  model->page.margin = 0;
-  first_page = poppler_document_get_page(model->doc, 0);
-  poppler_page_get_size(first_page, &model->page.dim.x, &model->page.dim.y);
-  model->page.dim.x++;
-  model->page.dim.y++;
-
-  // Set default view options
-  model->continuity = NONCONTINUOUS_VIEW;
-  model->fit = FIT_PAGE;
-  model->offset = 0;
-  model->scaling_index = get_scaling_index(model->page.dim.y, HeightOfScreen(common->screen));
-  model->scaling = zoom_lut[model->scaling_index];
-  
-  // Set window size 
-  common->window_size.x = model->scaling * model->page.dim.x;
-  common->window_size.y = model->scaling * model->page.dim.y;
+  // Headless runs always start from the same state
+  if (common->display && model->stamped)
+    sidecar = load_sidecar(common->input_file, model->mtime, model->size, model->num_of_pages);
+
+  model->geometry = init_geometry(common->document, model->doc, model->num_of_pages,
+      sidecar ? sidecar->dim : NULL);
+  model->layout = init_layout(model->geometry, 1, 0);
+  model->open_time = g_get_monotonic_time() - start;
+  model->open_rss = get_rss();
+
+  if (!sidecar || !restore_viewport(model, sidecar)) {
+    // Start with the first page
+    model->page.number = 0;
+    model->page.margin = 0;
+    model->page.dim = get_page_dim(model->geometry, 0);
 
-  model->queue = malloc(sizeof(queue_t));
-  model->queue->head = model->queue->tail = 0;
+    // Set default view options
+    model->continuity = NONCONTINUOUS_VIEW;
+    model->fit = FIT_PAGE;
+    model->offset = 0;
+    if (common->screen)
+      model->scaling_index = get_scaling_index(model->page.dim.y, HeightOfScreen(common->screen));
+    else
+      model->scaling_index = get_scaling_index(model->page.dim.y, common->window_size.y);
+    model->scaling = zoom_lut[model->scaling_index];
+
+    // Set window size
+    common->window_size.x = model->scaling * model->page.dim.x;
+    common->window_size.y = model->scaling * model->page.dim.y;
+  }
+
+  model->queue = init_queue(sizeof(scene_t *));
+  model->arena = init_arena(SCENE_ARENA_SIZE);
+  model->pages = init_page_handles(model->doc);
+
+  // The first frame is always drawn in full
+  model->frame.scenes = model->queue;
+  model->frame.arena = model->arena;
+  model->viewport.scaling = 0;
+  model->frame.generation = 0;
+  model->redraw = 1;
+  model->pending_since = 0;
+
+  // Headless runs draw every state they are asked for
+  model->animate = common->display && !getenv("READERX_NO_ANIMATION");
+  model->animation.active = 0;
+  model->animation.interval = 1000000 / (getenv("READERX_REFRESH_HZ")
+      && atoi(getenv("READERX_REFRESH_HZ")) > 0 ? atoi(getenv("READERX_REFRESH_HZ")) : DEFAULT_REFRESH_RATE);
+  model->animation.duration = ANIMATION_FRAMES * model->animation.interval;
+  model->animation_frames = 0;
+
+  model->search = init_search(common->document, model->num_of_pages, g_get_num_processors(),
+      common->search_fd);
+  model->prompt = model->query = NULL;
+  model->search_jumped = 0;
+  model->hit_page = model->frame.hit_page = -1;
+  model->hit_serial = 0;
+  model->highlight_frames = 0;
+  model->frame.search = model->search;
+  model->overview = model->selected = model->overview_margin = 0;
+
+  register_cache(common->governor, "search text", model->search, get_text_bytes, NULL);
+  register_cache(common->governor, "geometry", model->geometry, get_geometry_bytes, NULL);
+  register_cache(common->governor, "layout", model->layout, get_layout_bytes, NULL);
+
+  if (sidecar)
+    free_sidecar(sidecar);
 
-  g_object_unref(first_page);
   return model;
 }
 
+// Continue where the last session left the document. Returns 0 when
+// the saved viewport cannot be used, the defaults apply then.
+int restore_viewport(model_t *model, sidecar_t *sidecar)
+{
+  sidecar_header_t *header = &sidecar->header;
+
+  if (!(header->page_dim.x > 0 && header->page_dim.y > 0)
+      || header->window_size.x <= 0 || header->window_size.y <= 0)
+    return 0;
+
+  // The page size, offset and scaling were taken against this layout
+  set_layout(model->layout, CLAMP(header->columns, 1, model->num_of_pages), header->cover);
+  model->page.number = get_row_start(model->layout,
+      get_row(model->layout, CLAMP(header->page_number, 0, model->num_of_pages - 1)));
+  model->page.margin = header->margin;
+  model->page.dim = header->page_dim;
+  model->continuity = header->continuity == CONTINUOUS_VIEW ? CONTINUOUS_VIEW : NONCONTINUOUS_VIEW;
+  model->fit = CLAMP(header->fit, FIT_PAGE, FIT_FREE);
+  model->offset = header->offset;
+  model->scaling_index = CLAMP(header->scaling_index, 0, ZOOM_LUT_LENGTH - 1);
+  model->scaling = header->scaling > 0 ? header->scaling : zoom_lut[model->scaling_index];
+  model->common->window_size = header->window_size;
+
+  return 1;
+}
+
+void save_viewport(model_t *model)
+{
+  sidecar_t sidecar;
+  sidecar_header_t *header = &sidecar.header;
+
+  header->num_of_pages = model->num_of_pages;
+  header->num_of_dims = model->num_of_pages;
+  header->page_number = model->page.number;
+  header->margin = model->page.margin;
+  header->page_dim = model->page.dim;
+  header->continuity = model->continuity;
+  header->fit = model->fit;
+  header->offset = model->offset;
+  header->scaling_index = model->scaling_index;
+  header->scaling = model->scaling;
+  header->columns = model->layout->columns;
+  header->cover = model->layout->cover;
+  header->window_size = model->common->window_size;
+  header->mtime = model->mtime;
+  header->size = model->size;
+
+  // An unfinished index is not worth keeping
+  sidecar.dim = is_geometry_ready(model->geometry) ? model->geometry->dim : NULL;
+
+  save_sidecar(model->common->input_file, &sidecar);
+}
+
 void deinit_model(void *data)
 {
   model_t *model = (model_t *) data;
 
+  if (model->common->display && model->stamped)
+    save_viewport(model);
+
+  if (get_stats_stream()) {
+    fprintf(get_stats_stream(), "document: %ld MiB mapped, %d pages, opened in %ld ms\n",
+        (long) g_bytes_get_size(model->common->document) >> 20, model->num_of_pages,
+        model->open_time / 1000);
+    fprintf(get_stats_stream(), "rss: %ld MiB after open, %ld MiB at exit, %ld MiB peak\n",
+        model->open_rss >> 20, get_rss() >> 20, get_peak_rss() >> 20);
+    fprintf(get_stats_stream(), "page handles: %ld hits, %ld misses, scene arena: %ld allocations\n",
+        model->pages->hits, model->pages->misses, model->arena->allocations);
+    fprintf(get_stats_stream(), "scene queue: %ld growths\n", model->queue->growths);
+    if (model->animate)
+      fprintf(get_stats_stream(), "animation: %ld frames at %ld Hz\n",
+          model->animation_frames, 1000000 / model->animation.interval);
+    if (model->highlight_frames)
+      fprintf(get_stats_stream(), "frames: %ld redrawn for search highlights\n",
+          model->highlight_frames);
+    print_search_stats(model->search, get_stats_stream());
+  }
+
+  deinit_search(model->search);
+  free(model->prompt);
+  free(model->query);
+
+  deinit_page_handles(model->pages);
+  deinit_arena(model->arena);
+
+  deinit_layout(model->layout);
+  deinit_geometry(model->geometry);
   g_object_unref(model->doc);
-  free(model->queue);
+  g_bytes_unref(model->common->document);
+  deinit_queue(model->queue);
   free(model);
 }
 
 // Helper functions
 long get_document_length(model_t *model)
 {
-  fdim_t page_size;
-  int page_number;
-
-  long document_length = 0;
-
-  for (page_number = 0; page_number < model->num_of_pages; page_number++) {
-    page_size = get_page_size(model, page_number);
-    document_length += page_size.y;
-  }
-  return document_length;
+  return get_layout_length(model->layout) * model->scaling;
 }
 
+// The page dimensions are those of the row the page is on
 void set_page(model_t *model, int page_number)
 {
-  PopplerPage *page;
-  model->page.number = page_number;
-  page = poppler_document_get_page(model->doc, page_number);
-  model->page.margin = 0;
-  poppler_page_get_size(page, &model->page.dim.x, &model->page.dim.y);
-  model->page.dim.x++;
-  model->page.dim.y++;
+  int row = get_row(model->layout, page_number);
 
-  g_object_unref(page);
+  model->page.number = get_row_start(model->layout, row);
+  model->page.margin = 0;
+  model->page.dim = get_row_dim(model->layout, row);
 }
 
 fdim_t get_page_size(model_t *model, int page_number)
 {
-  fdim_t page_dim;
-  PopplerPage *page;
-  page = poppler_document_get_page(model->doc, page_number);
-  poppler_page_get_size(page, &page_dim.x, &page_dim.y);
-
-  page_dim.x++;
-  page_dim.y++;
+  fdim_t page_dim = get_page_dim(model->geometry, page_number);
 
   page_dim.x *= model->scaling;
   page_dim.y *= model->scaling;
 
-  g_object_unref(page);
-
   return page_dim;
 }
 
+fdim_t get_row_size(model_t *model, int row)
+{
+  fdim_t row_dim = get_row_dim(model->layout, row);
+
+  row_dim.x *= model->scaling;
+  row_dim.y *= model->scaling;
+
+  return row_dim;
+}
+
+// Vertical position of a row in the continuous view
+int get_row_margin(model_t *model, int row)
+{
+  return model->page.margin + get_row_position(model->layout, row) * model->scaling;
+}
+
+int get_page_margin(model_t *model, int page_number)
+{
+  return get_row_margin(model, get_row(model->layout, page_number));
+}
+
 int get_visible_length(int window_length, int page_length, int margin)
 {
   int visible_portion; 
@@ -132,7 +291,7 @@ void check_borders(model_t *model)
   fdim_t page_size;
   long document_length;
   dim_t window_size = model->common->window_size;
-  page_size = get_page_size(model, model->page.number);
+  page_size = get_row_size(model, get_row(model->layout, model->page.number));
 
   if (model->continuity == NONCONTINUOUS_VIEW) {
     if (window_size.y + 1 >= page_size.y)
@@ -166,15 +325,104 @@ void check_borders(model_t *model)
 
 }
 
+// Animation functions
+int is_animated(event_type_t type)
+{
+  switch (type) {
+    case ScrollDown:
+    case ScrollUp:
+    case ScrollLeft:
+    case ScrollRight:
+    case NextPage:
+    case PreviousPage:
+    case Jump:
+    case SearchNext:
+    case SearchPrevious:
+      return 1;
+    default:
+      return 0;
+  }
+}
+
+// Events that leave the view where it is
+int is_status_event(event_type_t type)
+{
+  switch (type) {
+    case SearchPrompt:
+    case Search:
+    case SearchProgress:
+      return 1;
+    default:
+      return 0;
+  }
+}
+
+// Where the view is on its way to the model position, eased out so the
+// motion starts fast and settles
+dim_t get_animated_position(model_t *model, long now)
+{
+  animation_t *animation = &model->animation;
+  dim_t position = { model->offset, model->page.margin };
+  double progress;
+
+  if (!animation->active)
+    return position;
+
+  progress = (double) (now - animation->start) / animation->duration;
+  if (progress >= 1) {
+    animation->active = 0;
+    if (g_atomic_int_compare_and_exchange(&model->common->incomplete, 1, 0))
+      model->redraw = 1;
+    return position;
+  }
+
+  progress = 1 - pow(1 - progress, 3);
+  position.x = animation->from.x + (animation->to.x - animation->from.x) * progress;
+  position.y = animation->from.y + (animation->to.y - animation->from.y) * progress;
+
+  return position;
+}
+
+// Glide from where the view is to the new model position, page changes
+// in the single page view still snap
+int start_animation(model_t *model, dim_t from, int page_number, long now)
+{
+  animation_t *animation = &model->animation;
+
+  check_borders(model);
+  animation->active = 0;
+
+  if (model->continuity == NONCONTINUOUS_VIEW && model->page.number != page_number)
+    return 0;
+  if (from.x == model->offset && from.y == model->page.margin)
+    return 0;
+
+  animation->from = from;
+  animation->to.x = model->offset;
+  animation->to.y = model->page.margin;
+  animation->start = now;
+  animation->active = 1;
+
+  return 1;
+}
+
+// Next refresh tick of the animation, ticks the view was too busy for
+// are skipped and not made up
+void arm_frame_timer(model_t *model, long now)
+{
+  animation_t *animation = &model->animation;
+
+  arm_timer(model->common, animation->interval - (now - animation->start) % animation->interval);
+}
+
 // Scene functions
 scene_t *create_scene(model_t *model, int page, int offset_x, int offset_y)
 {
-  scene_t *scn = malloc(sizeof(scene_t));
+  scene_t *scn = arena_alloc(model->arena, sizeof(scene_t));
 
-  scn->page = poppler_document_get_page(model->doc, page);
   scn->visible = 1;
   scn->page_no = page;
-  poppler_page_get_size(scn->page, &(scn->page_size.x), &(scn->page_size.y));
+  poppler_page_get_size(get_page_handle(model->pages, page), &(scn->page_size.x), &(scn->page_size.y));
   scn->scaling.x = scn->scaling.y = model->scaling;
   scn->offset.x = offset_x;
   scn->offset.y = offset_y;
@@ -182,50 +430,173 @@ scene_t *create_scene(model_t *model, int page, int offset_x, int offset_y)
   return scn;
 }
 
-void update_model(model_t *model)
+// Scrolls move what the last frame showed, anything else redraws it
+void update_frame(model_t *model)
 {
+  viewport_t *last = &model->viewport;
+  frame_t *frame = &model->frame;
+  dim_t window_size = model->common->window_size;
+
+  if (last->scaling != model->scaling || last->continuity != model->continuity
+      || last->window_size.x != window_size.x || last->window_size.y != window_size.y
+      || (model->continuity == NONCONTINUOUS_VIEW && last->page_number != model->page.number))
+    frame->redraw = 1;
+
+  frame->scroll.x = model->offset - last->offset;
+  frame->scroll.y = model->page.margin - last->margin;
+
+  if (abs(frame->scroll.x) >= window_size.x || abs(frame->scroll.y) >= window_size.y)
+    frame->redraw = 1;
+
+  if (frame->redraw)
+    frame->scroll.x = frame->scroll.y = 0;
+
+  last->page_number = model->page.number;
+  last->margin = model->page.margin;
+  last->offset = model->offset;
+  last->scaling = model->scaling;
+  last->continuity = model->continuity;
+  last->window_size = window_size;
+}
+
+// Whether a page reaches into the strips exposed by the scroll
+int is_exposed(model_t *model, int margin, int page_length)
+{
+  frame_t *frame = &model->frame;
+  int window_length = model->common->window_size.y;
+
+  if (frame->redraw || frame->scroll.x)
+    return 1;
+
+  if (frame->scroll.y < 0)
+    return margin + page_length > window_length + frame->scroll.y;
+
+  if (frame->scroll.y > 0)
+    return margin < frame->scroll.y;
+
+  return 0;
+}
+
+// A scene per page of the row, rows are centered on the current one.
+// A single column keeps its pages at the model offset.
+void add_row_scenes(model_t *model, int row, int margin)
+{
+  layout_t *layout = model->layout;
+  double left = model->offset;
+  int page_number;
   scene_t *scn;
-  int page_number, margin, capacity, page_length, visible_portion;
-  fdim_t page_size;
+
+  if (layout->columns > 1)
+    left += (model->page.dim.x - get_row_dim(layout, row).x) * model->scaling / 2;
+
+  for (page_number = get_row_start(layout, row); page_number < get_row_end(layout, row); page_number++) {
+    scn = create_scene(model, page_number, left + get_page_x(layout, page_number) * model->scaling,
+        margin + get_page_y(layout, page_number) * model->scaling);
+    enqueue(model->queue, &scn);
+  }
+}
+
+void update_model(model_t *model)
+{
+  int row, margin, capacity;
+  fdim_t row_size;
   dim_t window_size = model->common->window_size;
 
   check_borders(model);
+  update_frame(model);
 
-  if (model->continuity == NONCONTINUOUS_VIEW)
-    enqueue(model->queue, create_scene(model, model->page.number, model->offset, model->page.margin));
+  if (model->continuity == NONCONTINUOUS_VIEW
+      && is_exposed(model, model->page.margin, model->page.dim.y * model->scaling))
+    add_row_scenes(model, get_row(model->layout, model->page.number), model->page.margin);
 
   if (model->continuity == CONTINUOUS_VIEW) {
     
-    // Seek to the first visible page, calculate margin
-    margin = model->page.margin;
-    for (page_number = 0; page_number < model->num_of_pages; page_number++) {
-      page_size = get_page_size(model, page_number);
-      if ((margin + page_size.y) > 0)
-        break;
-      margin += page_size.y;
-    }
-    model->page.number = page_number;
+    // Seek to the first visible row
+    row = get_row_at(model->layout, -model->page.margin / model->scaling);
+    model->page.number = get_row_start(model->layout, row);
 
     // Create scenes to fill the view
-    for (capacity = window_size.y; (capacity >= 0) && (page_number < model->num_of_pages); page_number++) {
-      enqueue(model->queue, create_scene(model, page_number, model->offset, margin));
-      page_size = get_page_size(model, page_number);
-      capacity -= get_visible_length(window_size.y, page_size.y, margin);
-      LOG("Page number: %d, Margin: %d, Capacity: %d", page_number, margin, capacity);
-      margin += page_size.y;
+    for (capacity = window_size.y; (capacity >= 0) && (row < model->layout->num_of_rows); row++) {
+      margin = get_row_margin(model, row);
+      row_size = get_row_size(model, row);
+      if (is_exposed(model, margin, row_size.y))
+        add_row_scenes(model, row, margin);
+      capacity -= get_visible_length(window_size.y, row_size.y, margin);
+      LOG("Row: %d, Margin: %d, Capacity: %d", row, margin, capacity);
     }
   }
-  XClearWindow(model->common->display, model->common->drawable);
+}
+
+int get_overview_columns(model_t *model)
+{
+  return MAX((model->common->window_size.x - THUMBNAIL_GAP) / (THUMBNAIL_WIDTH + THUMBNAIL_GAP), 1);
+}
+
+// Only the rows in the window are laid out, a long document costs as much
+// as a short one. The rows of the next window are prefetched.
+void update_overview(model_t *model)
+{
+  dim_t window_size = model->common->window_size;
+  int columns = get_overview_columns(model), left, row, column, first_row, last_row, page_number;
+  double scaling;
+  fdim_t dim;
+  scene_t *scn;
+
+  left = (window_size.x - columns * (THUMBNAIL_WIDTH + THUMBNAIL_GAP) + THUMBNAIL_GAP) / 2;
+  first_row = -model->overview_margin / (THUMBNAIL_HEIGHT + THUMBNAIL_GAP);
+  last_row = first_row + 2 * (window_size.y / (THUMBNAIL_HEIGHT + THUMBNAIL_GAP) + 1);
+
+  for (row = first_row; row <= last_row; row++)
+    for (column = 0; column < columns && (page_number = row * columns + column) < model->num_of_pages; column++) {
+      dim = get_page_dim(model->geometry, page_number);
+      scaling = MIN(THUMBNAIL_WIDTH / dim.x, THUMBNAIL_HEIGHT / dim.y);
+
+      scn = arena_alloc(model->arena, sizeof(scene_t));
+      scn->page_no = page_number;
+      scn->page_size = dim;
+      scn->scaling.x = scn->scaling.y = scaling;
+      scn->offset.x = left + column * (THUMBNAIL_WIDTH + THUMBNAIL_GAP) + (THUMBNAIL_WIDTH - dim.x * scaling) / 2;
+      scn->offset.y = model->overview_margin + THUMBNAIL_GAP + row * (THUMBNAIL_HEIGHT + THUMBNAIL_GAP)
+        + (THUMBNAIL_HEIGHT - dim.y * scaling) / 2;
+      scn->visible = scn->offset.y < window_size.y;
+      enqueue(model->queue, &scn);
+    }
+
+  model->frame.scroll.x = model->frame.scroll.y = 0;
 }
 
 void update_window_title(model_t *model)
 {
-  if (model->continuity == CONTINUOUS_VIEW)
-    sprintf(model->common->window_title, "readerX - [C, %s, %d/%d] - ", 
-        zoom_string_lut[model->scaling_index], model->page.number + 1, model->num_of_pages);
+  char status[STR_MAX] = "", layout[16] = "";
+  int searched, pages;
+  long matches;
+
+  // The prompt while a search is typed, then the results as they come in
+  if (model->prompt)
+    snprintf(status, STR_MAX, " [/%.64s_]", model->prompt);
+  else if (model->query) {
+    get_search_progress(model->search, &searched, &pages, &matches);
+    if (searched < model->num_of_pages)
+      snprintf(status, STR_MAX, " [/%.64s: %ld on %d pages, %d%%]", model->query, matches, pages,
+          searched * 100 / model->num_of_pages);
+    else
+      snprintf(status, STR_MAX, " [/%.64s: %ld on %d pages]", model->query, matches, pages);
+  }
+
+  if (model->layout->cover)
+    snprintf(layout, sizeof(layout), " spread");
+  else if (model->layout->columns > 1)
+    snprintf(layout, sizeof(layout), " %d-up", model->layout->columns);
+
+  if (model->overview)
+    snprintf(model->frame.title, TITLE_MAX, "readerX - [overview, %d/%d]%s - ",
+        model->selected + 1, model->num_of_pages, status);
+  else if (model->continuity == CONTINUOUS_VIEW)
+    snprintf(model->frame.title, TITLE_MAX, "readerX - [C%s, %s, %d/%d]%s - ", layout,
+        zoom_string_lut[model->scaling_index], model->page.number + 1, model->num_of_pages, status);
   else
-    sprintf(model->common->window_title, "readerX - [NC, %s, %d/%d] - ", 
-        zoom_string_lut[model->scaling_index], model->page.number + 1, model->num_of_pages);
+    snprintf(model->frame.title, TITLE_MAX, "readerX - [NC%s, %s, %d/%d]%s - ", layout,
+        zoom_string_lut[model->scaling_index], model->page.number + 1, model->num_of_pages, status);
 }
 
 // Event handlers
@@ -263,16 +634,13 @@ void previous_page_event_handler(model_t *model)
     }
     else {
       if (model->page.number > 0)
-        set_page(model, --model->page.number);
+        set_page(model, model->page.number - 1);
     }
   }
 }
 
 void jump_event_handler(model_t *model, int rep)
 {
-  fdim_t page_dim;
-  int page;
-
   // Wrap around
   if (rep < 0)
     rep += model->num_of_pages;
@@ -282,15 +650,12 @@ void jump_event_handler(model_t *model, int rep)
 
   rep--;
 
-  if (model->continuity == NONCONTINUOUS_VIEW)
-    model->page.number = rep;
-  else {
-    model->page.margin = 0;
-    for (page = 0; page < rep; page++) {
-      page_dim = get_page_size(model, page);
-      model->page.margin -= page_dim.y;
-    }
+  if (model->continuity == NONCONTINUOUS_VIEW) {
+    model->page.number = get_row_start(model->layout, get_row(model->layout, rep));
+    model->page.dim = get_row_dim(model->layout, get_row(model->layout, rep));
   }
+  else
+    model->page.margin = -get_row_position(model->layout, get_row(model->layout, rep)) * model->scaling;
 }
 
 void scroll_up_event_handler(model_t *model, int rep)
@@ -308,12 +673,12 @@ void scroll_down_event_handler(model_t *model, int rep)
 {
   int limit;
 
-  while (rep > 0) {
-    if (model->continuity == CONTINUOUS_VIEW)
-      limit = model->common->window_size.y - get_document_length(model);
-    else
-      limit = model->common->window_size.y - model->page.dim.y * model->scaling;
+  if (model->continuity == CONTINUOUS_VIEW)
+    limit = model->common->window_size.y - get_document_length(model);
+  else
+    limit = model->common->window_size.y - model->page.dim.y * model->scaling;
 
+  while (rep > 0) {
     if (limit < 0) {
       model->page.margin -= VERTICAL_SCROLL_SPEED;
 
@@ -352,7 +717,7 @@ void scroll_right_event_handler(model_t *model, int rep)
 
 void next_page_event_handler(model_t *model)
 {
-  int step, page_height, window_height, visibility;
+  int step, page_height, window_height, visibility, page_number;
 
   window_height = model->common->window_size.y;
   page_height = model->scaling * model->page.dim.y;
@@ -371,8 +736,9 @@ void next_page_event_handler(model_t *model)
     if (visibility < step  && visibility != 0 && visibility > model->page.margin) 
       model->page.margin -= visibility;
     else if(visibility == 0 || visibility < model->page.margin) {
-      if (model->page.number < (model->num_of_pages - 1))
-        set_page(model, ++model->page.number);
+      page_number = get_row_end(model->layout, get_row(model->layout, model->page.number));
+      if (page_number < model->num_of_pages)
+        set_page(model, page_number);
     }
     else {
       model->page.margin -= step;
@@ -390,12 +756,9 @@ void continuity_event_handler(model_t *model)
   margin = model->page.margin;
 
   if (model->continuity == CONTINUOUS_VIEW) {
-    for (page_number = 0; page_number < model->num_of_pages; page_number++) {
-      page_size = get_page_size(model, page_number);
-      if ((margin + page_size.y) > 0)
-        break;
-      margin += page_size.y;
-    }
+    page_number = get_row_start(model->layout, get_row_at(model->layout, -margin / model->scaling));
+    page_size = get_row_size(model, get_row(model->layout, page_number));
+    margin = get_page_margin(model, page_number);
 
     set_page(model, page_number);
     model->page.margin = margin; 
@@ -408,10 +771,9 @@ void continuity_event_handler(model_t *model)
     model->continuity = NONCONTINUOUS_VIEW;
   }
   else {
-    for (page_number = 0; page_number < model->page.number; page_number++) {
-      page_size = get_page_size(model, page_number);
-      margin -= page_size.y;
-    }
+    page_number = model->page.number;
+    page_size = get_row_size(model, get_row(model->layout, page_number));
+    margin -= get_row_position(model->layout, get_row(model->layout, page_number)) * model->scaling;
     set_page(model, 0);
     model->page.number = page_number;
     // Page length starts from 0
@@ -423,6 +785,32 @@ void continuity_event_handler(model_t *model)
   }
 }
 
+// Without a count the layout cycles from single pages to spreads with
+// the cover on its own, to plain pairs. A count sets the columns.
+void layout_event_handler(model_t *model, int rep)
+{
+  layout_t *layout = model->layout;
+  int page_number = model->page.number;
+
+  if (rep > 0)
+    set_layout(layout, rep, 0);
+  else if (layout->columns == 1)
+    set_layout(layout, 2, 1);
+  else if (layout->cover)
+    set_layout(layout, 2, 0);
+  else
+    set_layout(layout, 1, 0);
+
+  // Fit to a full row rather than the cover
+  set_page(model, page_number);
+  if (layout->cover && model->page.number == 0 && layout->num_of_rows > 1)
+    model->page.dim = get_row_dim(layout, 1);
+  resize_event_handler(model);
+  if (model->continuity == CONTINUOUS_VIEW)
+    model->page.margin = -get_row_position(layout, get_row(layout, page_number)) * model->scaling;
+  model->offset = (model->common->window_size.x - model->scaling * model->page.dim.x) / 2;
+}
+
 void zoom_fit_event_handler(model_t *model)
 {
   switch (model->fit) {
@@ -437,10 +825,10 @@ void zoom_fit_event_handler(model_t *model)
   }
 }
 
-void zoom_in_event_handler(model_t *model)
+void zoom_in_event_handler(model_t *model, int rep)
 {
   int prev_scaling_index = model->scaling_index;
-  model->scaling_index++;
+  model->scaling_index += rep;
 
   if (model->scaling_index > ZOOM_LUT_LENGTH - 1)
     model->scaling_index = ZOOM_LUT_LENGTH - 1;
@@ -453,10 +841,10 @@ void zoom_in_event_handler(model_t *model)
   model->fit = FIT_FREE;
 }
 
-void zoom_out_event_handler(model_t *model)
+void zoom_out_event_handler(model_t *model, int rep)
 {
   int prev_scaling_index = model->scaling_index;
-  model->scaling_index--;
+  model->scaling_index -= rep;
 
   if (model->scaling_index < 0)
     model->scaling_index = 0;
@@ -469,13 +857,38 @@ void zoom_out_event_handler(model_t *model)
   model->fit = FIT_FREE;
 }
 
-queue_t *model_main(void *data, event_t event)
+// Events only change the model state, frames are built from the state
+// when the view is ready for one. Returns whether a frame is needed.
+int apply_event(void *data, event_t event)
 {
   model_t *model = (model_t *) data;
+  long now = g_get_monotonic_time();
+  int page_number = model->page.number, animated = 0;
+  dim_t position;
+
+  model->common->window_size = event.window_size;
+
+  // The overview takes the navigation keys while it is open
+  if (event.type == Overview || (model->overview && is_overview_event(event.type))) {
+    if (!overview_event_handler(model, event))
+      return 0;
+    model->animation.active = 0;
+    model->redraw = 1;
+    if (!model->pending_since)
+      model->pending_since = now;
+    return 1;
+  }
+
+  // Start from what the view shows, a running animation is redirected
+  if (model->animate && is_animated(event.type))
+    position = get_animated_position(model, now);
 
   switch (event.type) {
     case Standby:
-      break;
+    case Exit:
+    case Overview:
+    case Select:
+      return 0;
     case Resize:
       resize_event_handler(model);
       break;
@@ -508,17 +921,324 @@ queue_t *model_main(void *data, event_t event)
       resize_event_handler(model);
       break;
     case ZoomIn:
-      zoom_in_event_handler(model);
+      zoom_in_event_handler(model, event.rep);
       break;
     case ZoomOut:
-      zoom_out_event_handler(model);
+      zoom_out_event_handler(model, event.rep);
+      break;
+    case Timer:
+      // Next animation frame
+      if (!model->animation.active)
+        return 0;
+      break;
+    case Hud:
+      // Redraw with or without the overlay
+      break;
+    case SearchPrompt:
+      search_prompt_event_handler(model, event.text);
+      break;
+    case Search:
+      search_event_handler(model, event.text);
+      break;
+    case SearchNext:
+      search_next_event_handler(model, event.rep, 1);
+      break;
+    case SearchPrevious:
+      search_next_event_handler(model, event.rep, -1);
+      break;
+    case SearchProgress:
+      // Only the title changes unless the first match is jumped to
+      if (search_progress_event_handler(model))
+        model->redraw = 1;
       break;
+    case Layout:
+      layout_event_handler(model, event.rep);
+      break;
+  }
+
+  if (model->animate && is_animated(event.type))
+    animated = start_animation(model, position, page_number, now);
+  else if (event.type != Timer && event.type != Hud && !is_status_event(event.type))
+    model->animation.active = 0;
+
+  // Only scrolls and animations can reuse the last frame, status events
+  // only change the title
+  if (!animated && event.type != Timer && !is_status_event(event.type)
+      && event.type != ScrollUp && event.type != ScrollDown
+      && event.type != ScrollLeft && event.type != ScrollRight)
+    model->redraw = 1;
+
+  if (!model->pending_since)
+    model->pending_since = now;
+
+  return 1;
+}
+
+// The current match moved or a page in the window at the given position
+// got new highlights since the last frame. Highlights are drawn over the
+// cached pages, so the frame is redrawn in full to show them.
+int have_highlights_changed(model_t *model, dim_t position)
+{
+  layout_t *layout = model->layout;
+  int serial, changed, row, last, page_number;
+
+  // Read first, highlights found while the pages are checked show up in
+  // the next frame
+  serial = get_hit_serial(model->search);
+  changed = model->hit_page != model->frame.hit_page || model->hit != model->frame.hit;
+
+  if (model->continuity == NONCONTINUOUS_VIEW)
+    row = last = get_row(layout, model->page.number);
+  else {
+    row = get_row_at(layout, -position.y / model->scaling);
+    last = get_row_at(layout, (model->common->window_size.y - position.y) / model->scaling);
   }
 
-  if (event.type != Standby) {
+  for (; row <= last && !changed; row++)
+    for (page_number = get_row_start(layout, row); page_number < get_row_end(layout, row); page_number++)
+      changed |= get_hit_stamp(model->search, page_number) > model->hit_serial;
+
+  model->hit_serial = serial;
+  return changed;
+}
+
+// The scenes of the frame go into the queue, the view owns the frame
+// until it resets the arena
+frame_t *build_frame(void *data)
+{
+  model_t *model = (model_t *) data;
+  long allocations = model->arena->allocations + model->pages->misses;
+  long now = g_get_monotonic_time();
+  dim_t position = get_animated_position(model, now), target = { model->offset, model->page.margin };
+
+  if (!model->overview && have_highlights_changed(model, position) && !model->redraw) {
+    model->redraw = 1;
+    model->highlight_frames++;
+  }
+
+  model->frame.generation++;
+  model->frame.redraw = model->redraw;
+  model->frame.started = model->pending_since ? model->pending_since : now;
+  model->redraw = 0;
+  model->pending_since = 0;
+
+  // Scenes are laid out at the animated position, the model keeps the
+  // target the next events work from
+  model->frame.animated = model->animation.active;
+  model->frame.overview = model->overview;
+  model->frame.selected = model->selected;
+  if (model->overview)
+    update_overview(model);
+  else if (model->animation.active) {
+    model->offset = position.x;
+    model->page.margin = position.y;
     update_model(model);
-    update_window_title(model);
+    model->offset = target.x;
+    model->page.margin = target.y;
+    arm_frame_timer(model, now);
+    model->animation_frames++;
   }
+  else
+    update_model(model);
+  update_window_title(model);
+  model->frame.window_size = model->common->window_size;
+  model->frame.hit_page = model->hit_page;
+  model->frame.hit = model->hit;
+
+  add_count(model->common->profiler, ALLOCATION_COUNTER,
+      model->arena->allocations + model->pages->misses - allocations);
+
+  return &model->frame;
+}
+
+void search_prompt_event_handler(model_t *model, char *prompt)
+{
+  free(model->prompt);
+  model->prompt = prompt;
+}
+
+// A new search replaces the last one and starts from the current page
+void search_event_handler(model_t *model, char *query)
+{
+  search_prompt_event_handler(model, NULL);
+  if (!query)
+    return;
+
+  free(model->query);
+  model->query = query;
+  model->search_jumped = 0;
+  model->hit_page = -1;
+
+  start_search(model->search, query, model->page.number);
+}
+
+// Puts the current match a third down the window
+void jump_to_match(model_t *model)
+{
+  hit_t box;
+
+  jump_event_handler(model, model->hit_page + 1);
+  if (model->continuity == NONCONTINUOUS_VIEW)
+    model->page.margin = 0;
+  if (get_match_box(model->search, model->hit_page, model->hit, &box))
+    model->page.margin -= (get_page_y(model->layout, model->hit_page) + box.y) * model->scaling
+      - model->common->window_size.y / 3;
+
+  check_borders(model);
+  model->hit_margin = model->page.margin;
+}
+
+// Steps through the matches found so far, on to the next page with
+// matches once this one has none left. The search may still be running.
+void search_next_event_handler(model_t *model, int rep, int direction)
+{
+  int page_number, count;
+
+  // Start from the page in view once the user has moved away
+  if (model->hit_page < 0 || model->page.margin != model->hit_margin
+      || (model->continuity == NONCONTINUOUS_VIEW
+        && model->page.number != get_row_start(model->layout, get_row(model->layout, model->hit_page)))) {
+    model->hit_page = model->page.number;
+    model->hit = direction > 0 ? -1 : MAX(get_match_count(model->search, model->hit_page), 0);
+  }
+
+  while (rep-- > 0) {
+    count = get_match_count(model->search, model->hit_page);
+    if (model->hit + direction >= 0 && model->hit + direction < count)
+      model->hit += direction;
+    else if ((page_number = get_search_result(model->search, model->hit_page, direction)) >= 0) {
+      model->hit_page = page_number;
+      model->hit = direction > 0 ? 0 : get_match_count(model->search, page_number) - 1;
+    }
+    else
+      break;
+  }
+
+  if (model->hit >= 0 && get_match_count(model->search, model->hit_page) > model->hit)
+    jump_to_match(model);
+  model->search_jumped = 1;
+}
+
+// Jump to the first match once the pages before it are searched, later
+// results only update the title. Returns whether the view moved.
+int search_progress_event_handler(model_t *model)
+{
+  int page_number;
+
+  if (!model->query || model->search_jumped)
+    return 0;
+
+  if ((page_number = get_first_result(model->search, model->page.number)) < 0)
+    return 0;
+
+  model->search_jumped = 1;
+  model->hit_page = page_number;
+  model->hit = 0;
+  jump_to_match(model);
+
+  return 1;
+}
+
+int is_overview_event(event_type_t type)
+{
+  switch (type) {
+    case NextPage:
+    case PreviousPage:
+    case ScrollDown:
+    case ScrollUp:
+    case ScrollLeft:
+    case ScrollRight:
+    case Jump:
+    case Resize:
+    case Continuity:
+    case ZoomFit:
+    case ZoomIn:
+    case ZoomOut:
+    case Overview:
+    case Select:
+    case Layout:
+      return 1;
+    default:
+      return 0;
+  }
+}
+
+// Scrolls the grid so the row of the selected page is in the window
+void show_selection(model_t *model)
+{
+  int height = THUMBNAIL_HEIGHT + THUMBNAIL_GAP, window_height = model->common->window_size.y;
+  int top = model->selected / get_overview_columns(model) * height;
+
+  if (model->overview_margin + top < 0)
+    model->overview_margin = -top;
+  if (model->overview_margin + top + height + THUMBNAIL_GAP > window_height)
+    model->overview_margin = window_height - top - height - THUMBNAIL_GAP;
+  if (model->overview_margin > 0)
+    model->overview_margin = 0;
+}
+
+// Opens the overview on the current page, moves the selection while it
+// is open and jumps to the selected page. Returns whether anything changed.
+int overview_event_handler(model_t *model, event_t event)
+{
+  int columns = get_overview_columns(model);
+  int rows = MAX(model->common->window_size.y / (THUMBNAIL_HEIGHT + THUMBNAIL_GAP), 1);
+
+  if (!model->overview) {
+    model->overview = 1;
+    model->selected = model->page.number;
+    model->overview_margin = model->common->window_size.y / 2
+      - (model->selected / columns) * (THUMBNAIL_HEIGHT + THUMBNAIL_GAP) - THUMBNAIL_HEIGHT / 2;
+    show_selection(model);
+    return 1;
+  }
+
+  switch (event.type) {
+    case ScrollUp:
+      model->selected -= columns * event.rep;
+      break;
+    case ScrollDown:
+      model->selected += columns * event.rep;
+      break;
+    case ScrollLeft:
+      model->selected -= event.rep;
+      break;
+    case ScrollRight:
+      model->selected += event.rep;
+      break;
+    case PreviousPage:
+      model->selected -= columns * rows;
+      break;
+    case NextPage:
+      model->selected += columns * rows;
+      break;
+    case Jump:
+      // Same page numbers as jump_event_handler, 0 is the first page
+      model->selected = event.rep < 0 ? event.rep + model->num_of_pages - 1 : event.rep - 1;
+      break;
+    case Resize:
+      resize_event_handler(model);
+      break;
+    case Select:
+      jump_event_handler(model, model->selected + 1);
+      // fall through
+    case Overview:
+      model->overview = 0;
+      return 1;
+    default:
+      return 0;
+  }
+
+  model->selected = CLAMP(model->selected, 0, model->num_of_pages - 1);
+  show_selection(model);
+
+  return 1;
+}
+
+frame_t *model_main(void *data, event_t event)
+{
+  if (!apply_event(data, event))
+    return NULL;
 
-  return model->queue;
+  return build_frame(data);
 }
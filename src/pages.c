@@ -0,0 +1,52 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "pages.h"
+
+page_handles_t *init_page_handles(PopplerDocument *doc)
+{
+  page_handles_t *handles = malloc(sizeof(page_handles_t));
+
+  memset(handles, 0, sizeof(page_handles_t));
+  handles->doc = doc;
+
+  return handles;
+}
+
+void deinit_page_handles(page_handles_t *handles)
+{
+  int i;
+
+  for (i = 0; i < PAGE_HANDLE_CACHE_SIZE; i++)
+    if (handles->handles[i].page)
+      g_object_unref(handles->handles[i].page);
+  free(handles);
+}
+
+// Least recently used handle goes first, the page stays valid until
+// PAGE_HANDLE_CACHE_SIZE other pages have been asked for
+PopplerPage *get_page_handle(page_handles_t *handles, int page_number)
+{
+  page_handle_t *handle, *victim = NULL;
+  int i;
+
+  for (i = 0; i < PAGE_HANDLE_CACHE_SIZE; i++) {
+    handle = &handles->handles[i];
+    if (handle->page && handle->page_number == page_number) {
+      handle->last_used = ++handles->clock;
+      handles->hits++;
+      return handle->page;
+    }
+    if (!victim || (victim->page && (!handle->page || handle->last_used < victim->last_used)))
+      victim = handle;
+  }
+
+  if (victim->page)
+    g_object_unref(victim->page);
+  victim->page = poppler_document_get_page(handles->doc, page_number);
+  victim->page_number = page_number;
+  victim->last_used = ++handles->clock;
+  handles->misses++;
+
+  return victim->page;
+}
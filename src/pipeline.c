@@ -0,0 +1,214 @@
+#include <poll.h>
+#include <stdint.h>
+#include <sys/eventfd.h>
+
+#include "governor.h"
+#include "pipeline.h"
+#include "profiler.h"
+#include "util.h"
+
+static void ring(int fd)
+{
+  uint64_t count = 1;
+
+  if (write(fd, &count, sizeof(count)) < 0)
+    LOG("Cannot wake pipeline thread");
+}
+
+static void push_frame(pipeline_t *pipeline, frame_t *frame)
+{
+  enqueue(pipeline->frames, &frame);
+  ring(pipeline->view_fd);
+}
+
+// Animation ticks the view is still busy for are counted and dropped,
+// the next frame is built when the view is done
+static int tick(pipeline_t *pipeline)
+{
+  common_t *common = pipeline->common;
+  event_t event = { Timer, 1, common->window_size };
+  long latency = g_get_monotonic_time() - common->timer_deadline;
+
+  pipeline->ticks++;
+  pipeline->tick_latency += latency;
+  if (latency > pipeline->max_tick_latency)
+    pipeline->max_tick_latency = latency;
+  if (g_atomic_int_get(&pipeline->frames_in_flight))
+    pipeline->skipped_ticks++;
+
+  return apply_event(pipeline->readerx->model, event);
+}
+
+// Applies everything that came in, a frame is built only when the view
+// has shown the last one, the scene arena is then free again
+static gpointer run_model(gpointer data)
+{
+  pipeline_t *pipeline = (pipeline_t *) data;
+  void *model = pipeline->readerx->model;
+  profiler_t *profiler = pipeline->common->profiler;
+  event_t events[EVENT_BATCH], progress = { SearchProgress, 1 };
+  struct pollfd fds[3];
+  frame_t *frame;
+  uint64_t count;
+  int num_of_events, pending = 0, i;
+  long start, model_time = 0;
+
+  fds[0].fd = pipeline->model_fd;
+  fds[1].fd = pipeline->common->timer_fd;
+  fds[2].fd = pipeline->common->search_fd;
+  fds[0].events = fds[1].events = fds[2].events = POLLIN;
+
+  while (1) {
+    if (poll(fds, 3, -1) <= 0)
+      continue;
+
+    if (fds[1].revents & POLLIN && read(fds[1].fd, &count, sizeof(count)) > 0)
+      pending |= tick(pipeline);
+
+    // Any number of searched pages make one update
+    if (fds[2].revents & POLLIN && read(fds[2].fd, &count, sizeof(count)) > 0) {
+      progress.window_size = pipeline->common->window_size;
+      pending |= apply_event(model, progress);
+    }
+
+    if (fds[0].revents & POLLIN && read(fds[0].fd, &count, sizeof(count)) < 0)
+      continue;
+
+    while ((num_of_events = dequeue_batch(pipeline->events, events, EVENT_BATCH))) {
+      start = g_get_monotonic_time();
+      for (i = 0; i < num_of_events; i++) {
+        if (events[i].type == Exit) {
+          // The view finishes what it has and stops
+          push_frame(pipeline, NULL);
+          return NULL;
+        }
+        if (events[i].type == Hud && profiler)
+          g_atomic_int_set(&profiler->hud, !g_atomic_int_get(&profiler->hud));
+        pending |= apply_event(model, events[i]);
+      }
+      pipeline->events_applied += num_of_events;
+      model_time += g_get_monotonic_time() - start;
+    }
+
+    // Model time of a frame covers all events that went into it
+    if (pending && !g_atomic_int_get(&pipeline->frames_in_flight)) {
+      start = g_get_monotonic_time();
+      frame = build_frame(model);
+      add_sample(profiler, MODEL_STAGE, model_time + g_get_monotonic_time() - start);
+      model_time = 0;
+
+      g_atomic_int_set(&pipeline->frames_in_flight, 1);
+      push_frame(pipeline, frame);
+      pipeline->frames_built++;
+      pending = 0;
+    }
+  }
+}
+
+// Shows frames and picks up pages from the render pool as they finish
+static gpointer run_view(gpointer data)
+{
+  pipeline_t *pipeline = (pipeline_t *) data;
+  void *view = pipeline->readerx->view;
+  profiler_t *profiler = pipeline->common->profiler;
+  governor_t *governor = pipeline->common->governor;
+  struct pollfd fds[3];
+  frame_t *frame;
+  uint64_t count;
+  long start;
+
+  // The caches the governor shrinks belong to this thread
+  fds[0].fd = pipeline->view_fd;
+  fds[1].fd = pipeline->common->wakeup_fd;
+  fds[2].fd = governor ? governor->psi_fd : -1;
+  fds[0].events = fds[1].events = POLLIN;
+  fds[2].events = POLLPRI;
+
+  while (1) {
+    if (poll(fds, 3, -1) <= 0)
+      continue;
+
+    if (fds[2].revents & POLLPRI)
+      govern(governor, 1);
+
+    if (fds[1].revents & POLLIN && read(fds[1].fd, &count, sizeof(count)) > 0) {
+      start = g_get_monotonic_time();
+      view_wakeup(view);
+      add_sample(profiler, WAKEUP_STAGE, g_get_monotonic_time() - start);
+    }
+
+    if (!(fds[0].revents & POLLIN) || read(fds[0].fd, &count, sizeof(count)) < 0)
+      continue;
+
+    while (dequeue(pipeline->frames, &frame)) {
+      if (!frame)
+        return NULL;
+
+      start = g_get_monotonic_time();
+      view_main(view, frame);
+      add_sample(profiler, VIEW_STAGE, g_get_monotonic_time() - start);
+      add_sample(profiler, FRAME_STAGE, g_get_monotonic_time() - frame->started);
+      govern(governor, 0);
+
+      // Let the model build the next frame from what came in meanwhile
+      g_atomic_int_set(&pipeline->frames_in_flight, 0);
+      ring(pipeline->model_fd);
+    }
+  }
+}
+
+pipeline_t *init_pipeline(readerx_t *readerx, common_t *common)
+{
+  pipeline_t *pipeline = malloc(sizeof(pipeline_t));
+
+  pipeline->readerx = readerx;
+  pipeline->common = common;
+  pipeline->events = init_queue(sizeof(event_t));
+  pipeline->frames = init_queue(sizeof(frame_t *));
+  pipeline->model_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  pipeline->view_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  pipeline->frames_in_flight = 0;
+  pipeline->events_applied = pipeline->frames_built = 0;
+  pipeline->ticks = pipeline->skipped_ticks = 0;
+  pipeline->tick_latency = pipeline->max_tick_latency = 0;
+
+  if (pipeline->model_fd < 0 || pipeline->view_fd < 0) {
+    LOG("Cannot create pipeline eventfds");
+    return NULL;
+  }
+
+  pipeline->model_thread = g_thread_new("readerx-model", run_model, pipeline);
+  pipeline->view_thread = g_thread_new("readerx-view", run_view, pipeline);
+
+  return pipeline;
+}
+
+// Only after Exit was sent, the threads are done once they have seen it
+void deinit_pipeline(pipeline_t *pipeline)
+{
+  FILE *stats = get_stats_stream();
+
+  g_thread_join(pipeline->model_thread);
+  g_thread_join(pipeline->view_thread);
+
+  if (stats) {
+    fprintf(stats, "pipeline: %ld events applied in %ld frames, event queue %ld growths\n",
+        pipeline->events_applied, pipeline->frames_built, pipeline->events->growths);
+    if (pipeline->ticks)
+      fprintf(stats, "frame timer: %ld ticks, %ld skipped, latency %ld us avg, %ld us max\n",
+          pipeline->ticks, pipeline->skipped_ticks, pipeline->tick_latency / pipeline->ticks,
+          pipeline->max_tick_latency);
+  }
+
+  close(pipeline->model_fd);
+  close(pipeline->view_fd);
+  deinit_queue(pipeline->events);
+  deinit_queue(pipeline->frames);
+  free(pipeline);
+}
+
+void send_event(pipeline_t *pipeline, event_t event)
+{
+  enqueue(pipeline->events, &event);
+  ring(pipeline->model_fd);
+}
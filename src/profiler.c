@@ -0,0 +1,143 @@
+#include "common.h"
+#include "profiler.h"
+#include "util.h"
+
+static char *stage_names[STAGE_COUNT] = {
+  "input", "model", "view", "render", "present", "wakeup", "frame"
+};
+
+static char *counter_names[COUNTER_COUNT] = {
+  "allocs"
+};
+
+profiler_t *init_profiler(void)
+{
+  profiler_t *profiler = malloc(sizeof(profiler_t));
+
+  memset(profiler, 0, sizeof(profiler_t));
+  g_mutex_init(&profiler->lock);
+
+  return profiler;
+}
+
+void deinit_profiler(profiler_t *profiler)
+{
+  if (get_stats_stream())
+    print_profile(profiler, get_stats_stream());
+
+  g_mutex_clear(&profiler->lock);
+  free(profiler);
+}
+
+char *get_stage_name(profile_stage_t stage)
+{
+  return stage_names[stage];
+}
+
+char *get_counter_name(profile_counter_t counter)
+{
+  return counter_names[counter];
+}
+
+static void add_to_histogram(histogram_t *histogram, long value)
+{
+  int bucket;
+
+  histogram->window[histogram->next] = value;
+  histogram->next = (histogram->next + 1) % PROFILE_WINDOW;
+
+  for (bucket = 0; bucket < PROFILE_BUCKETS - 1 && value >= (1L << bucket); bucket++)
+    ;
+  histogram->buckets[bucket]++;
+
+  histogram->samples++;
+  histogram->total += value;
+  if (value > histogram->max)
+    histogram->max = value;
+}
+
+// Stages are timed by the caller with g_get_monotonic_time, a missing
+// profiler makes this a no-op
+void add_sample(profiler_t *profiler, profile_stage_t stage, long usec)
+{
+  if (!profiler)
+    return;
+
+  g_mutex_lock(&profiler->lock);
+  add_to_histogram(&profiler->stages[stage], usec);
+  g_mutex_unlock(&profiler->lock);
+}
+
+// Counters are sampled once per frame
+void add_count(profiler_t *profiler, profile_counter_t counter, long count)
+{
+  if (!profiler)
+    return;
+
+  g_mutex_lock(&profiler->lock);
+  add_to_histogram(&profiler->counters[counter], count);
+  g_mutex_unlock(&profiler->lock);
+}
+
+// Copy of the histograms for readers on other threads
+void get_profile(profiler_t *profiler, histogram_t *stages, histogram_t *counters)
+{
+  g_mutex_lock(&profiler->lock);
+  memcpy(stages, profiler->stages, sizeof(profiler->stages));
+  memcpy(counters, profiler->counters, sizeof(profiler->counters));
+  g_mutex_unlock(&profiler->lock);
+}
+
+static int compare_samples(const void *a, const void *b)
+{
+  long sample_a = *(const long *) a, sample_b = *(const long *) b;
+
+  return (sample_a > sample_b) - (sample_a < sample_b);
+}
+
+// Percentile over the last PROFILE_WINDOW samples
+long get_rolling_percentile(histogram_t *histogram, int percentile)
+{
+  long sorted[PROFILE_WINDOW];
+  int count = MIN(histogram->samples, PROFILE_WINDOW);
+
+  if (!count)
+    return 0;
+
+  memcpy(sorted, histogram->window, count * sizeof(long));
+  qsort(sorted, count, sizeof(long), compare_samples);
+
+  return sorted[(count - 1) * percentile / 100];
+}
+
+static void print_histogram(FILE *stream, char *name, histogram_t *histogram, char *unit)
+{
+  int bucket;
+
+  if (!histogram->samples)
+    return;
+
+  fprintf(stream, "profile: %-7s %ld samples, %ld%s avg, %ld%s max, last %d p50 %ld%s p95 %ld%s\n",
+      name, histogram->samples, histogram->total / histogram->samples, unit, histogram->max, unit,
+      (int) MIN(histogram->samples, PROFILE_WINDOW), get_rolling_percentile(histogram, 50), unit,
+      get_rolling_percentile(histogram, 95), unit);
+
+  fprintf(stream, "profile: %-7s", name);
+  for (bucket = 0; bucket < PROFILE_BUCKETS; bucket++)
+    if (histogram->buckets[bucket] && bucket == PROFILE_BUCKETS - 1)
+      fprintf(stream, " >=%ld%s:%ld", 1L << (bucket - 1), unit, histogram->buckets[bucket]);
+    else if (histogram->buckets[bucket])
+      fprintf(stream, " <%ld%s:%ld", 1L << bucket, unit, histogram->buckets[bucket]);
+  fprintf(stream, "\n");
+}
+
+void print_profile(profiler_t *profiler, FILE *stream)
+{
+  int stage, counter;
+
+  for (stage = 0; stage < STAGE_COUNT; stage++)
+    print_histogram(stream, stage_names[stage], &profiler->stages[stage], " us");
+
+  for (counter = 0; counter < COUNTER_COUNT; counter++)
+    print_histogram(stream, counter_names[counter], &profiler->counters[counter], "");
+}
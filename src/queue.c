@@ -0,0 +1,105 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "queue.h"
+
+static queue_ring_t *new_ring(guint capacity, size_t item_size)
+{
+  queue_ring_t *ring = malloc(sizeof(queue_ring_t) + capacity * item_size);
+
+  ring->next = NULL;
+  ring->head = ring->tail = 0;
+  ring->capacity = capacity;
+
+  return ring;
+}
+
+queue_t *init_queue(size_t item_size)
+{
+  queue_t *queue = malloc(sizeof(queue_t));
+
+  queue->item_size = item_size;
+  queue->read = queue->write = new_ring(QUEUE_RING_LENGTH, item_size);
+  queue->growths = 0;
+
+  return queue;
+}
+
+void deinit_queue(queue_t *queue)
+{
+  queue_ring_t *ring, *next;
+
+  for (ring = queue->read; ring; ring = next) {
+    next = ring->next;
+    free(ring);
+  }
+  free(queue);
+}
+
+// Producer side, the tail is published once for the whole batch
+void enqueue_batch(queue_t *queue, const void *items, int count)
+{
+  queue_ring_t *ring = queue->write, *next;
+  guint tail = ring->tail;
+  int i;
+
+  for (i = 0; i < count; i++) {
+    if (tail - (guint) g_atomic_int_get(&ring->head) == ring->capacity) {
+      // The tail of a ring is final before the consumer can see the next one
+      g_atomic_int_set(&ring->tail, tail);
+      next = new_ring(2 * ring->capacity, queue->item_size);
+      g_atomic_pointer_set(&ring->next, next);
+      queue->write = ring = next;
+      queue->growths++;
+      tail = 0;
+    }
+
+    memcpy(ring->items + (tail & (ring->capacity - 1)) * queue->item_size,
+        (const char *) items + i * queue->item_size, queue->item_size);
+    tail++;
+  }
+
+  g_atomic_int_set(&ring->tail, tail);
+}
+
+// Consumer side, returns the number of items taken
+int dequeue_batch(queue_t *queue, void *items, int max)
+{
+  queue_ring_t *ring = queue->read, *next;
+  guint head = ring->head, tail;
+  int count = 0;
+
+  while (count < max) {
+    tail = g_atomic_int_get(&ring->tail);
+
+    if (head == tail) {
+      if (!(next = g_atomic_pointer_get(&ring->next)))
+        break;
+      // Items may have been added before the producer moved on
+      if (head != (guint) g_atomic_int_get(&ring->tail))
+        continue;
+      queue->read = next;
+      free(ring);
+      ring = next;
+      head = 0;
+      continue;
+    }
+
+    for (; head != tail && count < max; head++, count++)
+      memcpy((char *) items + count * queue->item_size,
+          ring->items + (head & (ring->capacity - 1)) * queue->item_size, queue->item_size);
+    g_atomic_int_set(&ring->head, head);
+  }
+
+  return count;
+}
+
+void enqueue(queue_t *queue, const void *item)
+{
+  enqueue_batch(queue, item, 1);
+}
+
+int dequeue(queue_t *queue, void *item)
+{
+  return dequeue_batch(queue, item, 1);
+}
@@ -1,4 +1,11 @@
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+
 #include "common.h"
+#include "governor.h"
+#include "pipeline.h"
+#include "profiler.h"
+#include "trace.h"
 #include "util.h"
 
 common_t *init_common(char *filepath)
@@ -6,6 +13,7 @@ common_t *init_common(char *filepath)
   common_t *common = malloc(sizeof(common_t));
 
   common->input_file = filepath;
+  common->document = NULL;
   common->display = XOpenDisplay(NULL);
   common->screen = DefaultScreenOfDisplay(common->display);
   common->window_size.x = common->window_size.y = DEFAULT_WINDOW_DIM;
@@ -14,9 +22,25 @@ common_t *init_common(char *filepath)
       0, 0, common->window_size.x, common->window_size.y,
       0, 0, READERX_BACKGROUND_LIGHT);
 
+  // Render completions wake the view thread, the timer and search
+  // results the model thread. Presents wake the controller, XSync on
+  // the view thread may have queued input it is not polling for.
+  common->wakeup_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  common->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  common->search_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  common->input_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  common->timer_deadline = 0;
+  common->incomplete = 0;
+
+  common->profiler = init_profiler();
+
   if (!common || !common->input_file || !common->display || !common->screen)
     return NULL;
 
+  // Without READERX_MEMORY_MB only memory pressure shrinks the caches
+  common->governor = init_governor(getenv("READERX_MEMORY_MB")
+      ? atol(getenv("READERX_MEMORY_MB")) * 1024 * 1024 : 0);
+
   return common;
 }
 
@@ -30,11 +54,8 @@ readerx_t *init_readerx(char *filepath)
     return NULL;
   }
 
-  readerx->controller  = init_controller(common);
-  if (!readerx->controller) {
-    LOG("Failed to initialize controller");
-    return NULL;
-  }
+  readerx->profiler = common->profiler;
+  readerx->governor = common->governor;
 
   readerx->model = init_model(common);
   if (!readerx->model) {
@@ -48,13 +69,33 @@ readerx_t *init_readerx(char *filepath)
     return NULL;
   }
 
+  // The controller starts from the window size the model chose
+  readerx->controller  = init_controller(common);
+  if (!readerx->controller) {
+    LOG("Failed to initialize controller");
+    return NULL;
+  }
+
+  readerx->trace = init_trace(common);
+
+  readerx->pipeline = init_pipeline(readerx, common);
+  if (!readerx->pipeline) {
+    LOG("Failed to start the pipeline");
+    return NULL;
+  }
+
   return readerx;
 }
 
 int deinit_readerx(readerx_t *readerx)
 {
+  deinit_pipeline(readerx->pipeline);
+  deinit_governor(readerx->governor);
+  if (readerx->trace)
+    deinit_trace(readerx->trace);
   deinit_view(readerx->view);
   deinit_model(readerx->model);
+  deinit_profiler(readerx->profiler);
   deinit_controller(readerx->controller);
 
   free(readerx);
@@ -65,22 +106,28 @@ int deinit_readerx(readerx_t *readerx)
 int main(int argc, char *argv[])
 {
   readerx_t *readerx;
+  trace_t *trace;
   event_t event;
-  queue_t *scene_queue;
 
   char *filepath = NULL;
 
+  // Controller and view share the display connection
+  XInitThreads();
+
   if (filepath = parse_input(argc, argv))
     if (readerx = init_readerx(filepath)) {
-      while (1) {
-        event = controller_main(readerx->controller);
-        if (event.type == Exit)
-          break;
-        if (event.type != Standby) {
-          scene_queue = model_main(readerx->model, event);
-          view_main(readerx->view, scene_queue);
+      trace = readerx->trace;
+      do {
+        if (trace && trace->replay)
+          event = trace_main(trace);
+        else {
+          event = controller_main(readerx->controller);
+          if (trace)
+            record_event(trace, event);
         }
-      }
+        if (event.type != Standby)
+          send_event(readerx->pipeline, event);
+      } while (event.type != Exit);
       deinit_readerx(readerx);
     }
 
@@ -0,0 +1,372 @@
+#include <stdint.h>
+
+#include "render.h"
+#include "util.h"
+
+// Width and height are in pixels at the rendered scaling
+int is_tiled(double width, double height)
+{
+  return width * height > TILED_PAGE_AREA;
+}
+
+cairo_surface_t *render_page(PopplerPage *page, double scaling)
+{
+  cairo_surface_t *surface;
+  cairo_t *cairo;
+  double width, height;
+
+  poppler_page_get_size(page, &width, &height);
+  surface = cairo_image_surface_create(CAIRO_FORMAT_RGB24,
+      ceil(width * scaling), ceil(height * scaling));
+  cairo = cairo_create(surface);
+
+  // PDF background color
+  cairo_set_source_rgb(cairo, 1, 1, 1);
+  cairo_paint(cairo);
+
+  cairo_scale(cairo, scaling, scaling);
+  poppler_page_render(page, cairo);
+  cairo_destroy(cairo);
+
+  return surface;
+}
+
+// Tiles on the right and bottom edge are cut to the page
+cairo_surface_t *render_tile(PopplerPage *page, double scaling, dim_t tile)
+{
+  cairo_surface_t *surface;
+  cairo_t *cairo;
+  double width, height;
+
+  poppler_page_get_size(page, &width, &height);
+  width = MIN(TILE_SIZE, ceil(width * scaling) - tile.x * TILE_SIZE);
+  height = MIN(TILE_SIZE, ceil(height * scaling) - tile.y * TILE_SIZE);
+
+  surface = cairo_image_surface_create(CAIRO_FORMAT_RGB24, MAX(width, 1), MAX(height, 1));
+  cairo = cairo_create(surface);
+
+  // PDF background color
+  cairo_set_source_rgb(cairo, 1, 1, 1);
+  cairo_paint(cairo);
+
+  cairo_translate(cairo, -tile.x * TILE_SIZE, -tile.y * TILE_SIZE);
+  cairo_scale(cairo, scaling, scaling);
+  poppler_page_render(page, cairo);
+  cairo_destroy(cairo);
+
+  return surface;
+}
+
+// Embedded thumbnails are scaled to the page size at the given scaling,
+// pages without one are rendered
+cairo_surface_t *render_thumbnail(PopplerPage *page, double scaling, int *embedded)
+{
+  cairo_surface_t *thumbnail, *surface;
+  cairo_t *cairo;
+  double width, height;
+
+  if (!(*embedded = (thumbnail = poppler_page_get_thumbnail(page)) != NULL))
+    return render_page(page, scaling);
+
+  poppler_page_get_size(page, &width, &height);
+  width = ceil(width * scaling);
+  height = ceil(height * scaling);
+  surface = cairo_image_surface_create(CAIRO_FORMAT_RGB24, width, height);
+  cairo = cairo_create(surface);
+
+  cairo_scale(cairo, width / cairo_image_surface_get_width(thumbnail),
+      height / cairo_image_surface_get_height(thumbnail));
+  cairo_set_source_surface(cairo, thumbnail, 0, 0);
+  cairo_paint(cairo);
+  cairo_destroy(cairo);
+  cairo_surface_destroy(thumbnail);
+
+  return surface;
+}
+
+static void push_job(worker_t *worker, render_job_t *job)
+{
+  g_mutex_lock(&worker->lock);
+  job->next = NULL;
+  if (worker->tail[job->priority])
+    worker->tail[job->priority]->next = job;
+  else
+    worker->head[job->priority] = job;
+  worker->tail[job->priority] = job;
+  g_mutex_unlock(&worker->lock);
+}
+
+static render_job_t *pop_job(worker_t *worker, render_priority_t priority)
+{
+  render_job_t *job;
+
+  g_mutex_lock(&worker->lock);
+  job = worker->head[priority];
+  if (job) {
+    worker->head[priority] = job->next;
+    if (!job->next)
+      worker->tail[priority] = NULL;
+  }
+  g_mutex_unlock(&worker->lock);
+
+  return job;
+}
+
+// Own queue first, then steal, so a visible page is never left waiting
+// behind another worker's prefetch
+static render_job_t *find_job(worker_t *worker)
+{
+  render_pool_t *pool = worker->pool;
+  render_job_t *job;
+  int priority, i, self = worker - pool->workers;
+
+  for (priority = 0; priority < PRIORITY_COUNT; priority++) {
+    if (job = pop_job(worker, priority))
+      return job;
+
+    for (i = 1; i < pool->num_of_workers; i++)
+      if (job = pop_job(&pool->workers[(self + i) % pool->num_of_workers], priority)) {
+        worker->stolen++;
+        return job;
+      }
+  }
+
+  return NULL;
+}
+
+// Jobs no frame since the current one has asked for. The pool generation
+// is read first, the view raises job generations before it publishes a
+// new one, so work the current frame needs is never dropped.
+static int is_stale(render_pool_t *pool, render_job_t *job)
+{
+  int generation = g_atomic_int_get(&pool->generation);
+
+  return g_atomic_int_get(&job->generation) < generation;
+}
+
+static gpointer run_worker(gpointer data)
+{
+  worker_t *worker = (worker_t *) data;
+  render_pool_t *pool = worker->pool;
+  render_job_t *job;
+  PopplerPage *page;
+  cairo_surface_t *unsaved;
+  cache_key_t key;
+  long start;
+  int embedded;
+
+  // Opened here so that starting the pool does not delay the first page
+  worker->doc = poppler_document_new_from_bytes(pool->bytes, NULL, NULL);
+
+  while (1) {
+    g_mutex_lock(&pool->lock);
+    while (!pool->pending && !pool->quit)
+      g_cond_wait(&pool->cond, &pool->lock);
+    if (pool->quit) {
+      g_mutex_unlock(&pool->lock);
+      break;
+    }
+    // Claim one of the queued jobs, it is found in some queue below
+    pool->pending--;
+    g_mutex_unlock(&pool->lock);
+
+    while (!(job = find_job(worker)))
+      ;
+
+    // Pages outside of the document come back without a surface, so do
+    // pages the view has scrolled past before they were started
+    job->surface = unsaved = NULL;
+    if (is_stale(pool, job)) {
+      job->cancelled = 1;
+      worker->cancelled++;
+    }
+    else if (worker->doc && (page = poppler_document_get_page(worker->doc, job->key.page_no))) {
+      // Pages rendered in an earlier session come from disk
+      if (pool->disk_cache)
+        job->surface = load_surface(pool->disk_cache, &job->key);
+      if (!job->surface) {
+        start = g_get_monotonic_time();
+        if (job->key.tile.x == WHOLE_PAGE)
+          job->surface = render_page(page, job->key.scaling);
+        else if (job->key.tile.x == THUMBNAIL) {
+          job->surface = render_thumbnail(page, job->key.scaling, &embedded);
+          worker->embedded += embedded;
+        }
+        else
+          job->surface = render_tile(page, job->key.scaling, job->key.tile);
+        worker->rendered++;
+
+        // Superseded while it was rendered, it is still cached
+        if (is_stale(pool, job)) {
+          worker->wasted++;
+          worker->wasted_time += g_get_monotonic_time() - start;
+        }
+        else
+          worker->useful_time += g_get_monotonic_time() - start;
+        if (pool->disk_cache && job->surface) {
+          unsaved = cairo_surface_reference(job->surface);
+          key = job->key;
+        }
+      }
+      g_object_unref(page);
+    }
+
+    // Wake up the view thread
+    job->finished = g_get_monotonic_time();
+    g_async_queue_push(pool->done, job);
+    if (pool->wakeup_fd >= 0)
+      write(pool->wakeup_fd, &(uint64_t) { 1 }, sizeof(uint64_t));
+
+    // Written once the view has the page, the job belongs to it now
+    if (unsaved) {
+      save_surface(pool->disk_cache, &key, unsaved);
+      cairo_surface_destroy(unsaved);
+    }
+  }
+
+  return NULL;
+}
+
+render_pool_t *init_render_pool(GBytes *bytes, int num_of_workers, int wakeup_fd,
+    disk_cache_t *disk_cache)
+{
+  render_pool_t *pool;
+  worker_t *worker;
+  int i, priority;
+
+  pool = malloc(sizeof(render_pool_t));
+  pool->num_of_workers = num_of_workers;
+  pool->workers = malloc(num_of_workers * sizeof(worker_t));
+  pool->next_worker = 0;
+  pool->pending = 0;
+  pool->quit = 0;
+  pool->done = g_async_queue_new();
+  pool->wakeup_fd = wakeup_fd;
+  pool->disk_cache = disk_cache;
+  pool->generation = 0;
+  g_mutex_init(&pool->lock);
+  g_cond_init(&pool->cond);
+
+  // All workers share the mapped document
+  pool->bytes = g_bytes_ref(bytes);
+  for (i = 0; i < num_of_workers; i++) {
+    worker = &pool->workers[i];
+    worker->pool = pool;
+    worker->doc = NULL;
+    worker->rendered = worker->stolen = worker->embedded = worker->cancelled = worker->wasted = 0;
+    worker->useful_time = worker->wasted_time = 0;
+    g_mutex_init(&worker->lock);
+    for (priority = 0; priority < PRIORITY_COUNT; priority++)
+      worker->head[priority] = worker->tail[priority] = NULL;
+  }
+
+  for (i = 0; i < num_of_workers; i++)
+    pool->workers[i].thread = g_thread_new("render", run_worker, &pool->workers[i]);
+
+  LOG("Started %d render workers", num_of_workers);
+  return pool;
+}
+
+void deinit_render_pool(render_pool_t *pool)
+{
+  render_job_t *job;
+  worker_t *worker;
+  int i, priority;
+
+  g_mutex_lock(&pool->lock);
+  pool->quit = 1;
+  g_cond_broadcast(&pool->cond);
+  g_mutex_unlock(&pool->lock);
+
+  for (i = 0; i < pool->num_of_workers; i++)
+    g_thread_join(pool->workers[i].thread);
+
+  for (i = 0; i < pool->num_of_workers; i++) {
+    worker = &pool->workers[i];
+    for (priority = 0; priority < PRIORITY_COUNT; priority++)
+      while (job = pop_job(worker, priority))
+        free_render_job(job);
+    if (worker->doc)
+      g_object_unref(worker->doc);
+    g_mutex_clear(&worker->lock);
+  }
+
+  while (job = g_async_queue_try_pop(pool->done))
+    free_render_job(job);
+
+  g_async_queue_unref(pool->done);
+  g_mutex_clear(&pool->lock);
+  g_cond_clear(&pool->cond);
+  g_bytes_unref(pool->bytes);
+  free(pool->workers);
+  free(pool);
+}
+
+// The job stays valid until it is collected and freed
+render_job_t *submit_render_job(render_pool_t *pool, cache_key_t *key,
+    render_priority_t priority, int generation)
+{
+  render_job_t *job = malloc(sizeof(render_job_t));
+
+  job->key = *key;
+  job->priority = priority;
+  job->generation = generation;
+  job->cancelled = 0;
+  job->surface = NULL;
+
+  push_job(&pool->workers[pool->next_worker], job);
+  pool->next_worker = (pool->next_worker + 1) % pool->num_of_workers;
+
+  g_mutex_lock(&pool->lock);
+  pool->pending++;
+  g_cond_signal(&pool->cond);
+  g_mutex_unlock(&pool->lock);
+
+  return job;
+}
+
+// Jobs of older generations are dropped from here on
+void set_render_generation(render_pool_t *pool, int generation)
+{
+  g_atomic_int_set(&pool->generation, generation);
+}
+
+// Finished jobs, blocks until one is available if wait is set
+render_job_t *collect_render_job(render_pool_t *pool, int wait)
+{
+  if (wait)
+    return g_async_queue_pop(pool->done);
+
+  return g_async_queue_try_pop(pool->done);
+}
+
+void free_render_job(render_job_t *job)
+{
+  if (job->surface)
+    cairo_surface_destroy(job->surface);
+  free(job);
+}
+
+void print_render_stats(render_pool_t *pool, FILE *stream)
+{
+  long rendered = 0, stolen = 0, embedded = 0, cancelled = 0, wasted = 0;
+  long useful_time = 0, wasted_time = 0;
+  int i;
+
+  for (i = 0; i < pool->num_of_workers; i++) {
+    rendered += pool->workers[i].rendered;
+    stolen += pool->workers[i].stolen;
+    embedded += pool->workers[i].embedded;
+    cancelled += pool->workers[i].cancelled;
+    wasted += pool->workers[i].wasted;
+    useful_time += pool->workers[i].useful_time;
+    wasted_time += pool->workers[i].wasted_time;
+  }
+
+  fprintf(stream, "render pool: %d workers, %ld pages and tiles rendered, %ld jobs stolen\n",
+      pool->num_of_workers, rendered, stolen);
+  if (embedded)
+    fprintf(stream, "render pool: %ld embedded thumbnails used\n", embedded);
+  fprintf(stream, "render pool: %ld stale jobs cancelled, %ld finished stale, "
+      "%ld ms useful, %ld ms wasted\n", cancelled, wasted, useful_time / 1000, wasted_time / 1000);
+}
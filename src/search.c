@@ -0,0 +1,439 @@
+#include <stdint.h>
+
+#include "search.h"
+#include "util.h"
+
+// Case insensitive, the query is lower case already. Offsets of the
+// matches in characters go to offsets unless it is NULL.
+int count_matches(const char *text, gunichar *query, int query_length, int *offsets)
+{
+  const char *start, *end;
+  int count = 0, offset, i;
+
+  for (start = text, offset = 0; *start; start = g_utf8_next_char(start), offset++) {
+    for (end = start, i = 0; i < query_length && *end
+        && g_unichar_tolower(g_utf8_get_char(end)) == query[i]; end = g_utf8_next_char(end), i++)
+      ;
+    if (i == query_length) {
+      if (offsets)
+        offsets[count] = offset;
+      count++;
+    }
+  }
+
+  return count;
+}
+
+// Pages are extracted once, a page two searches raced for keeps the
+// text that got there first
+static char *get_page_text(search_t *search, PopplerDocument *doc, int page_number)
+{
+  PopplerPage *page;
+  char *text;
+  long start;
+
+  if ((text = g_atomic_pointer_get(&search->text[page_number]))) {
+    g_mutex_lock(&search->lock);
+    search->cache_hits++;
+    g_mutex_unlock(&search->lock);
+    return text;
+  }
+
+  start = g_get_monotonic_time();
+  if (!(page = poppler_document_get_page(doc, page_number)))
+    return NULL;
+  text = poppler_page_get_text(page);
+  g_object_unref(page);
+  if (!text)
+    text = g_strdup("");
+
+  if (!g_atomic_pointer_compare_and_exchange(&search->text[page_number], NULL, text)) {
+    g_free(text);
+    return g_atomic_pointer_get(&search->text[page_number]);
+  }
+
+  g_mutex_lock(&search->lock);
+  search->extracted++;
+  search->extracted_bytes += strlen(text);
+  search->extract_time += g_get_monotonic_time() - start;
+  g_mutex_unlock(&search->lock);
+
+  return text;
+}
+
+// Only pages with matches need their layout, poppler has a box for
+// each character of the text
+static text_layout_t *get_page_layout(search_t *search, PopplerDocument *doc, int page_number)
+{
+  PopplerRectangle *rectangles;
+  PopplerPage *page;
+  text_layout_t *layout;
+  guint length, i;
+
+  if ((layout = g_atomic_pointer_get(&search->layouts[page_number])))
+    return layout;
+
+  if (!(page = poppler_document_get_page(doc, page_number)))
+    return NULL;
+  if (!poppler_page_get_text_layout(page, &rectangles, &length)) {
+    rectangles = NULL;
+    length = 0;
+  }
+  g_object_unref(page);
+
+  layout = malloc(sizeof(text_layout_t));
+  layout->length = length;
+  layout->boxes = malloc(length * sizeof(text_box_t));
+  for (i = 0; i < length; i++)
+    layout->boxes[i] = (text_box_t) { rectangles[i].x1, rectangles[i].y1, rectangles[i].x2, rectangles[i].y2 };
+  g_free(rectangles);
+
+  if (!g_atomic_pointer_compare_and_exchange(&search->layouts[page_number], NULL, layout)) {
+    free(layout->boxes);
+    free(layout);
+    return g_atomic_pointer_get(&search->layouts[page_number]);
+  }
+
+  g_mutex_lock(&search->lock);
+  search->layouts_extracted++;
+  search->layout_bytes += length * sizeof(text_box_t);
+  g_mutex_unlock(&search->lock);
+
+  return layout;
+}
+
+// Boxes around the characters of each match, growing along a line
+static hit_t *get_hits(text_layout_t *layout, int *offsets, int matches, int query_length, int *count)
+{
+  hit_t *hits = NULL, *hit;
+  text_box_t *box;
+  int match, i;
+
+  *count = 0;
+  for (match = 0; match < matches; match++)
+    for (i = offsets[match], hit = NULL; i < offsets[match] + query_length && i < layout->length; i++) {
+      box = &layout->boxes[i];
+      if (hit && box->x1 >= hit->x && box->y1 < hit->y + hit->height) {
+        hit->width = MAX(hit->x + hit->width, box->x2) - hit->x;
+        hit->height = MAX(hit->y + hit->height, box->y2) - MIN(hit->y, box->y1);
+        hit->y = MIN(hit->y, box->y1);
+        continue;
+      }
+
+      hits = realloc(hits, (*count + 1) * sizeof(hit_t));
+      hit = &hits[(*count)++];
+      *hit = (hit_t) { match, box->x1, box->y1, box->x2 - box->x1, box->y2 - box->y1 };
+    }
+
+  return hits;
+}
+
+static gpointer run_search_worker(gpointer data)
+{
+  search_t *search = (search_t *) data;
+  PopplerDocument *doc = NULL;
+  gunichar query[SEARCH_MAX];
+  int query_length, generation, page_number, matches, num_of_hits, *offsets;
+  text_layout_t *layout;
+  hit_t *hits;
+  char *text;
+
+  while (1) {
+    g_mutex_lock(&search->lock);
+    while (search->next >= search->num_of_pages && !search->quit)
+      g_cond_wait(&search->cond, &search->lock);
+    if (search->quit) {
+      g_mutex_unlock(&search->lock);
+      break;
+    }
+    page_number = search->order[search->next++];
+    generation = search->generation;
+    query_length = search->query_length;
+    memcpy(query, search->query, query_length * sizeof(gunichar));
+    g_mutex_unlock(&search->lock);
+
+    // Opened on the first search, most sessions never search
+    if (!doc)
+      doc = poppler_document_new_from_bytes(search->bytes, NULL, NULL);
+
+    text = doc ? get_page_text(search, doc, page_number) : NULL;
+    matches = text ? count_matches(text, query, query_length, NULL) : 0;
+
+    hits = NULL;
+    num_of_hits = 0;
+    if (matches > 0 && (layout = get_page_layout(search, doc, page_number))) {
+      offsets = malloc(matches * sizeof(int));
+      count_matches(text, query, query_length, offsets);
+      hits = get_hits(layout, offsets, matches, query_length, &num_of_hits);
+      free(offsets);
+    }
+
+    g_mutex_lock(&search->lock);
+    if (generation == search->generation) {
+      search->matches[page_number] = matches;
+      search->searched++;
+      search->hits[page_number] = hits;
+      search->num_of_hits[page_number] = num_of_hits;
+      search->hit_stamps[page_number] = ++search->hit_serial;
+      hits = NULL;
+    }
+    g_mutex_unlock(&search->lock);
+    free(hits);
+
+    if (search->wakeup_fd >= 0)
+      write(search->wakeup_fd, &(uint64_t) { 1 }, sizeof(uint64_t));
+  }
+
+  if (doc)
+    g_object_unref(doc);
+
+  return NULL;
+}
+
+search_t *init_search(GBytes *bytes, int num_of_pages, int num_of_workers, int wakeup_fd)
+{
+  search_t *search = malloc(sizeof(search_t));
+  int i;
+
+  search->bytes = g_bytes_ref(bytes);
+  search->num_of_pages = num_of_pages;
+  search->num_of_workers = num_of_workers;
+  search->quit = 0;
+  search->text = calloc(num_of_pages, sizeof(char *));
+  search->layouts = calloc(num_of_pages, sizeof(text_layout_t *));
+  search->generation = 0;
+  search->query_length = 0;
+  search->order = malloc(num_of_pages * sizeof(int));
+  search->matches = malloc(num_of_pages * sizeof(int));
+  search->hits = calloc(num_of_pages, sizeof(hit_t *));
+  search->num_of_hits = calloc(num_of_pages, sizeof(int));
+  search->hit_stamps = calloc(num_of_pages, sizeof(int));
+  search->hit_serial = 0;
+  search->next = search->searched = num_of_pages;
+  search->wakeup_fd = wakeup_fd;
+  search->extracted = search->extracted_bytes = search->cache_hits = search->extract_time = 0;
+  search->layouts_extracted = search->layout_bytes = 0;
+  g_mutex_init(&search->lock);
+  g_cond_init(&search->cond);
+
+  for (i = 0; i < num_of_pages; i++)
+    search->matches[i] = -1;
+
+  search->threads = malloc(num_of_workers * sizeof(GThread *));
+  for (i = 0; i < num_of_workers; i++)
+    search->threads[i] = g_thread_new("search", run_search_worker, search);
+
+  return search;
+}
+
+void deinit_search(search_t *search)
+{
+  int i;
+
+  g_mutex_lock(&search->lock);
+  search->quit = 1;
+  g_cond_broadcast(&search->cond);
+  g_mutex_unlock(&search->lock);
+
+  for (i = 0; i < search->num_of_workers; i++)
+    g_thread_join(search->threads[i]);
+
+  for (i = 0; i < search->num_of_pages; i++) {
+    g_free(search->text[i]);
+    if (search->layouts[i])
+      free(search->layouts[i]->boxes);
+    free(search->layouts[i]);
+    free(search->hits[i]);
+  }
+
+  g_mutex_clear(&search->lock);
+  g_cond_clear(&search->cond);
+  g_bytes_unref(search->bytes);
+  free(search->threads);
+  free(search->text);
+  free(search->layouts);
+  free(search->hits);
+  free(search->num_of_hits);
+  free(search->hit_stamps);
+  free(search->order);
+  free(search->matches);
+  free(search);
+}
+
+// Pages closest to the start page are searched first, alternating
+// forward and backward
+void start_search(search_t *search, char *query, int page)
+{
+  const char *c;
+  int i, distance;
+
+  g_mutex_lock(&search->lock);
+  search->generation++;
+
+  search->query_length = 0;
+  for (c = query; *c && search->query_length < SEARCH_MAX; c = g_utf8_next_char(c))
+    search->query[search->query_length++] = g_unichar_tolower(g_utf8_get_char(c));
+
+  for (i = 0, distance = 0; i < search->num_of_pages; distance++) {
+    if (page + distance < search->num_of_pages)
+      search->order[i++] = page + distance;
+    if (distance && page - distance >= 0)
+      search->order[i++] = page - distance;
+  }
+  // Every page loses its highlights
+  search->hit_serial++;
+  for (i = 0; i < search->num_of_pages; i++) {
+    search->matches[i] = -1;
+    free(search->hits[i]);
+    search->hits[i] = NULL;
+    search->num_of_hits[i] = 0;
+    search->hit_stamps[i] = search->hit_serial;
+  }
+
+  search->next = search->query_length ? 0 : search->num_of_pages;
+  search->searched = 0;
+  g_cond_broadcast(&search->cond);
+  g_mutex_unlock(&search->lock);
+}
+
+// Next page after this one with a match in the given direction, the
+// search wraps around the document, -1 if nothing was found yet
+int get_search_result(search_t *search, int page, int direction)
+{
+  int i, index, n = search->num_of_pages, result = -1;
+
+  g_mutex_lock(&search->lock);
+  for (i = 1; i <= n && result < 0; i++) {
+    index = ((page + direction * i) % n + n) % n;
+    if (search->matches[index] > 0)
+      result = index;
+  }
+  g_mutex_unlock(&search->lock);
+
+  return result;
+}
+
+// First match from this page forward once every page up to it has been
+// searched, -1 while that is not known yet
+int get_first_result(search_t *search, int page)
+{
+  int i, index, result = -1;
+
+  g_mutex_lock(&search->lock);
+  for (i = 0; i < search->num_of_pages; i++) {
+    index = (page + i) % search->num_of_pages;
+    if (search->matches[index] < 0)
+      break;
+    if (search->matches[index] > 0) {
+      result = index;
+      break;
+    }
+  }
+  g_mutex_unlock(&search->lock);
+
+  return result;
+}
+
+// Matches on a page, -1 while it is not searched
+int get_match_count(search_t *search, int page)
+{
+  int count;
+
+  g_mutex_lock(&search->lock);
+  count = search->matches[page];
+  g_mutex_unlock(&search->lock);
+
+  return count;
+}
+
+// First box of a match, 0 if the page has none
+int get_match_box(search_t *search, int page, int match, hit_t *box)
+{
+  int found = 0, i;
+
+  g_mutex_lock(&search->lock);
+  for (i = 0; i < search->num_of_hits[page] && !found; i++)
+    if (search->hits[page][i].match == match) {
+      *box = search->hits[page][i];
+      found = 1;
+    }
+  g_mutex_unlock(&search->lock);
+
+  return found;
+}
+
+// Copies the highlights of a page, at most max of them
+int get_page_hits(search_t *search, int page, hit_t *hits, int max)
+{
+  int count;
+
+  g_mutex_lock(&search->lock);
+  count = MIN(search->num_of_hits[page], max);
+  memcpy(hits, search->hits[page], count * sizeof(hit_t));
+  g_mutex_unlock(&search->lock);
+
+  return count;
+}
+
+// Highlights change with the serial, a page whose stamp is newer than
+// the serial it was drawn at needs drawing again
+int get_hit_serial(search_t *search)
+{
+  int serial;
+
+  g_mutex_lock(&search->lock);
+  serial = search->hit_serial;
+  g_mutex_unlock(&search->lock);
+
+  return serial;
+}
+
+int get_hit_stamp(search_t *search, int page)
+{
+  int stamp;
+
+  g_mutex_lock(&search->lock);
+  stamp = search->hit_stamps[page];
+  g_mutex_unlock(&search->lock);
+
+  return stamp;
+}
+
+// Text and layouts, the cache the governor accounts for
+long get_search_bytes(search_t *search)
+{
+  long bytes;
+
+  g_mutex_lock(&search->lock);
+  bytes = search->extracted_bytes + search->layout_bytes;
+  g_mutex_unlock(&search->lock);
+
+  return bytes;
+}
+
+void get_search_progress(search_t *search, int *searched, int *pages, long *matches)
+{
+  int i;
+
+  g_mutex_lock(&search->lock);
+  *searched = search->searched;
+  *pages = 0;
+  *matches = 0;
+  for (i = 0; i < search->num_of_pages; i++)
+    if (search->matches[i] > 0) {
+      (*pages)++;
+      *matches += search->matches[i];
+    }
+  g_mutex_unlock(&search->lock);
+}
+
+void print_search_stats(search_t *search, FILE *stream)
+{
+  if (!search->extracted && !search->cache_hits)
+    return;
+
+  fprintf(stream, "search: %ld pages extracted (%ld KiB) in %ld ms, %ld cached pages reused, "
+      "%ld layouts (%ld KiB)\n", search->extracted, search->extracted_bytes >> 10,
+      search->extract_time / 1000, search->cache_hits, search->layouts_extracted,
+      search->layout_bytes >> 10);
+}
@@ -0,0 +1,107 @@
+#include <sys/stat.h>
+
+#include "sidecar.h"
+#include "disk_cache.h"
+#include "util.h"
+
+char *get_sidecar_path(char *uri)
+{
+  char *hash = g_compute_checksum_for_string(G_CHECKSUM_SHA1, uri, -1);
+  char *path = g_build_filename(g_get_user_cache_dir(), DISK_CACHE_DIR, SIDECAR_DIR, hash, NULL);
+
+  g_free(hash);
+  return path;
+}
+
+// Taken before the document is mapped, a file rebuilt later on is
+// then stamped as older than it is and its sidecar is not trusted
+int stamp_document(char *uri, int64_t *mtime, int64_t *size)
+{
+  struct stat info;
+  char *filename = g_filename_from_uri(uri, NULL, NULL);
+  int result = filename ? stat(filename, &info) : -1;
+
+  if (!result) {
+    *mtime = info.st_mtime;
+    *size = info.st_size;
+  }
+
+  g_free(filename);
+  return result;
+}
+
+// Returns NULL when there is no sidecar or it belongs to another stamp
+// or page count
+sidecar_t *load_sidecar(char *uri, int64_t mtime, int64_t size, int num_of_pages)
+{
+  sidecar_t *sidecar;
+  char *path;
+  FILE *file;
+
+  path = get_sidecar_path(uri);
+  file = fopen(path, "rb");
+  g_free(path);
+  if (!file)
+    return NULL;
+
+  if (!(sidecar = malloc(sizeof(sidecar_t)))) {
+    fclose(file);
+    return NULL;
+  }
+  sidecar->dim = NULL;
+
+  if (fread(&sidecar->header, sizeof(sidecar_header_t), 1, file) != 1
+      || memcmp(sidecar->header.magic, SIDECAR_MAGIC, sizeof(sidecar->header.magic))
+      || sidecar->header.mtime != mtime || sidecar->header.size != size
+      || sidecar->header.num_of_pages != num_of_pages) {
+    LOG("Stale sidecar for %s", uri);
+    fclose(file);
+    free(sidecar);
+    return NULL;
+  }
+
+  if (sidecar->header.num_of_dims == num_of_pages
+      && (sidecar->dim = malloc(num_of_pages * sizeof(fdim_t)))) {
+    if (fread(sidecar->dim, sizeof(fdim_t), num_of_pages, file) != num_of_pages) {
+      free(sidecar->dim);
+      sidecar->dim = NULL;
+    }
+  }
+  fclose(file);
+
+  return sidecar;
+}
+
+// The caller fills in the header with the stamp taken at open
+void save_sidecar(char *uri, sidecar_t *sidecar)
+{
+  char *path, *dir, *temp;
+  FILE *file;
+  int written;
+
+  memcpy(sidecar->header.magic, SIDECAR_MAGIC, sizeof(sidecar->header.magic));
+  if (!sidecar->dim)
+    sidecar->header.num_of_dims = 0;
+
+  path = get_sidecar_path(uri);
+  dir = g_path_get_dirname(path);
+  temp = g_strconcat(path, ".tmp", NULL);
+
+  if (!g_mkdir_with_parents(dir, 0700) && (file = fopen(temp, "wb"))) {
+    written = fwrite(&sidecar->header, sizeof(sidecar_header_t), 1, file) == 1
+      && fwrite(sidecar->dim, sizeof(fdim_t), sidecar->header.num_of_dims, file)
+        == sidecar->header.num_of_dims;
+    if (fclose(file) || !written || rename(temp, path))
+      unlink(temp);
+  }
+
+  g_free(temp);
+  g_free(dir);
+  g_free(path);
+}
+
+void free_sidecar(sidecar_t *sidecar)
+{
+  free(sidecar->dim);
+  free(sidecar);
+}
@@ -0,0 +1,173 @@
+#include "trace.h"
+#include "util.h"
+
+trace_t *init_trace_recorder(common_t *common, char *path)
+{
+  trace_t *trace;
+  FILE *file = fopen(path, "wb");
+
+  if (!file) {
+    LOG("Failed to open trace %s", path);
+    return NULL;
+  }
+
+  fwrite(TRACE_MAGIC, 1, TRACE_MAGIC_LEN, file);
+
+  trace = malloc(sizeof(trace_t));
+  trace->common = common;
+  trace->file = file;
+  trace->replay = 0;
+  trace->speed = 1;
+  trace->start = g_get_monotonic_time();
+  trace->has_next = 0;
+  trace->window_size = common->window_size;
+  trace->events = 0;
+
+  return trace;
+}
+
+static int read_trace_record(trace_t *trace)
+{
+  trace->has_next = fread(&trace->next, sizeof(trace_record_t), 1, trace->file) == 1;
+
+  return trace->has_next;
+}
+
+// A speed of 0 replays as fast as frames can be produced
+trace_t *init_trace_player(common_t *common, char *path, double speed)
+{
+  trace_t *trace;
+  char magic[TRACE_MAGIC_LEN];
+  FILE *file = fopen(path, "rb");
+
+  if (!file) {
+    LOG("Failed to open trace %s", path);
+    return NULL;
+  }
+
+  if (fread(magic, 1, TRACE_MAGIC_LEN, file) != TRACE_MAGIC_LEN ||
+      memcmp(magic, TRACE_MAGIC, TRACE_MAGIC_LEN)) {
+    LOG("%s is not a readerx trace", path);
+    fclose(file);
+    return NULL;
+  }
+
+  trace = malloc(sizeof(trace_t));
+  trace->common = common;
+  trace->file = file;
+  trace->replay = 1;
+  trace->speed = speed > 0 ? speed : 0;
+  trace->start = 0;
+  trace->window_size = common->window_size;
+  trace->events = 0;
+  read_trace_record(trace);
+
+  return trace;
+}
+
+// Recording and replay are selected by READERX_RECORD and READERX_REPLAY
+trace_t *init_trace(common_t *common)
+{
+  char *path, *speed;
+
+  if ((path = getenv("READERX_REPLAY"))) {
+    speed = getenv("READERX_REPLAY_SPEED");
+    return init_trace_player(common, path, speed ? strtod(speed, NULL) : 1);
+  }
+
+  if ((path = getenv("READERX_RECORD")))
+    return init_trace_recorder(common, path);
+
+  return NULL;
+}
+
+void deinit_trace(trace_t *trace)
+{
+  FILE *stats = get_stats_stream();
+
+  if (stats)
+    fprintf(stats, "trace: %s %ld events in %ld ms\n", trace->replay ? "replayed" : "recorded",
+        trace->events, trace->start ? (g_get_monotonic_time() - trace->start) / 1000 : 0);
+
+  fclose(trace->file);
+  free(trace);
+}
+
+void record_event(trace_t *trace, event_t event)
+{
+  trace_record_t record;
+
+  // Frame timers are regenerated by the replayed session
+  if (event.type == Standby || event.type == Timer)
+    return;
+
+  record.type = event.type;
+  record.rep = event.rep;
+  record.timestamp = g_get_monotonic_time() - trace->start;
+  record.width = event.window_size.x;
+  record.height = event.window_size.y;
+
+  fwrite(&record, sizeof(trace_record_t), 1, trace->file);
+  trace->events++;
+}
+
+// Hand out the next recorded event, restoring the window size it saw
+int read_trace_event(trace_t *trace, event_t *event)
+{
+  common_t *common = trace->common;
+
+  if (!trace->has_next)
+    return 0;
+
+  if (!trace->start)
+    trace->start = g_get_monotonic_time();
+
+  event->type = trace->next.type;
+  event->rep = trace->next.rep;
+  event->window_size.x = trace->next.width;
+  event->window_size.y = trace->next.height;
+  event->text = NULL;
+
+  if (trace->window_size.x != event->window_size.x || trace->window_size.y != event->window_size.y) {
+    trace->window_size = event->window_size;
+    if (common->display)
+      XResizeWindow(common->display, common->drawable, trace->window_size.x, trace->window_size.y);
+  }
+
+  trace->events++;
+  read_trace_record(trace);
+
+  return 1;
+}
+
+// Microseconds until the next event is due
+long get_trace_delay(trace_t *trace)
+{
+  long delay;
+
+  if (!trace->start)
+    trace->start = g_get_monotonic_time();
+
+  if (!trace->speed || !trace->has_next)
+    return 0;
+
+  delay = trace->next.timestamp / trace->speed - (g_get_monotonic_time() - trace->start);
+
+  return delay > 0 ? delay : 0;
+}
+
+// Replay stand-in for controller_main, sleeps until the next recorded
+// event is due
+event_t trace_main(trace_t *trace)
+{
+  event_t event = { Standby, 1, trace->window_size };
+  long delay = get_trace_delay(trace);
+
+  if (delay)
+    g_usleep(delay);
+
+  if (!read_trace_event(trace, &event))
+    event.type = Exit;
+
+  return event;
+}
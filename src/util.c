@@ -1,14 +1,109 @@
+#include <sys/mman.h>
+#include <sys/timerfd.h>
+
 #include "common.h"
 #include "util.h"
 
-char *get_datetime(void) {
-  time_t current_time;
-  char *c_time_string;
+// Stats are written to the file named by READERX_STATS, "-" means stderr
+FILE *get_stats_stream(void)
+{
+  static FILE *stream;
+  char *path;
+
+  if (stream)
+    return stream;
+
+  path = getenv("READERX_STATS");
+  if (!path)
+    return NULL;
+
+  if (!strcmp(path, "-"))
+    stream = stderr;
+  else
+    stream = fopen(path, "a");
+
+  return stream;
+}
+
+void print_bandwidth(FILE *stream, char *name, long bytes, long usec)
+{
+  fprintf(stream, "%s: %ld MiB in %ld ms (%.1f MiB/s)\n", name, bytes >> 20, usec / 1000,
+      usec ? (bytes / 1048576.0) / (usec / 1000000.0) : 0.0);
+}
+
+// One-shot frame timer, delivered to the model thread as a Timer event
+void arm_timer(common_t *common, long usec)
+{
+  struct itimerspec spec = { { 0, 0 }, { usec / 1000000, (usec % 1000000) * 1000 } };
+
+  common->timer_deadline = g_get_monotonic_time() + usec;
+  timerfd_settime(common->timer_fd, 0, &spec, NULL);
+}
+
+// Resident set size in bytes
+long get_rss(void)
+{
+  FILE *statm = fopen("/proc/self/statm", "r");
+  long pages = 0;
+
+  if (!statm)
+    return 0;
 
-  current_time = time(NULL);
-  c_time_string = ctime(&current_time);
+  if (fscanf(statm, "%*d %ld", &pages) != 1)
+    pages = 0;
+  fclose(statm);
 
-  return strtok(c_time_string, "\n");
+  return pages * sysconf(_SC_PAGESIZE);
+}
+
+long get_peak_rss(void)
+{
+  FILE *status = fopen("/proc/self/status", "r");
+  char line[STR_MAX];
+  long kib = 0;
+
+  if (!status)
+    return 0;
+
+  while (fgets(line, STR_MAX, status))
+    if (sscanf(line, "VmHWM: %ld kB", &kib) == 1)
+      break;
+  fclose(status);
+
+  return kib * 1024;
+}
+
+// Map the document rather than read it, pages fault in as poppler
+// touches them. Poppler starts from the xref at the end and linearized
+// files keep the first page at the start, the body is left to the
+// kernel readahead since image streams are read front to back.
+GBytes *map_document(char *uri)
+{
+  GMappedFile *file;
+  GBytes *bytes;
+  char *filename, *contents;
+  long length, tail, page_size = sysconf(_SC_PAGESIZE);
+
+  if (!(filename = g_filename_from_uri(uri, NULL, NULL)))
+    return NULL;
+
+  file = g_mapped_file_new(filename, FALSE, NULL);
+  g_free(filename);
+  if (!file)
+    return NULL;
+
+  contents = g_mapped_file_get_contents(file);
+  length = g_mapped_file_get_length(file);
+  if (contents && length) {
+    madvise(contents, MIN(length, DOCUMENT_HEAD_SIZE), MADV_WILLNEED);
+    tail = MAX(0, length - DOCUMENT_TAIL_SIZE) & ~(page_size - 1);
+    madvise(contents + tail, length - tail, MADV_WILLNEED);
+  }
+
+  bytes = g_mapped_file_get_bytes(file);
+  g_mapped_file_unref(file);
+
+  return bytes;
 }
 
 // Parse and validate input
@@ -36,60 +131,3 @@ char *parse_input(int input_num, char *input_str[])
 
   return uri;
 }
-
-int enqueue(queue_t *queue, void *item)
-{
-  if ((queue->head == 0 && queue->tail == (MAX_QUEUE_LENGTH - 1))
-      || ((queue->head - queue->tail) == 1)) {
-    LOG("Queue overflow occured");
-    return -1;
-  }
-
-  queue->q[queue->tail] = item;
-  if (queue->tail == MAX_QUEUE_LENGTH - 1)
-    queue->tail = 0;
-  else
-    queue->tail++;
-
-  LOG("head: %d, tail: %d", queue->head, queue->tail);
-  return 0; 
-}
-
-void *dequeue(queue_t *queue)
-{
-  void *item;
-
-  if (queue->head == queue->tail) {
-    LOG("Queue underflow occured");
-    return NULL;
-  }
-
-  item = queue->q[queue->head];
-  if (queue->head == MAX_QUEUE_LENGTH - 1)
-    queue->head = 0;
-  else
-    queue->head++;
-
-  LOG("head: %d, tail: %d", queue->head, queue->tail);
-  return item;
-}
-
-int readerx_log(char *file, const char *func, int line, char *fmt, ...)
-{
-  static FILE *logger;
-  va_list ap;
-  char log_message[STR_MAX];
-
-  logger = fopen(LOG_FILEPATH, "a");
-
-  sprintf(log_message, "%s at %s (%s:%d) :", get_datetime(), func, file, line);
-  strcat(log_message, fmt);
-  strcat(log_message, "\n");
-
-  va_start(ap, fmt);
-  vfprintf(logger, log_message, ap);
-  va_end(ap);
-
-  fclose(logger);
-  return 0;
-}
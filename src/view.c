@@ -1,4 +1,6 @@
 #include "view.h"
+#include "backend.h"
+#include "governor.h"
 #include "util.h"
 
 #include <X11/Xatom.h>
@@ -13,32 +15,123 @@ static unsigned char icon_bits[] = {
   0x04, 0xd8, 0x00, 0x04, 0x8c, 0x00, 0x04, 0x86, 0x01, 0x04, 0x02, 0x03,
   0x04, 0x03, 0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 };
 
+static long get_page_cache_bytes(void *data)
+{
+  return ((view_t *) data)->cache->bytes;
+}
+
+// The pages of about two windows stay, so the visible ones are not
+// rendered again every frame
+static long evict_pages(void *data, long bytes)
+{
+  view_t *view = (view_t *) data;
+  long keep = 2L * 4 * view->backbuffer.size.x * view->backbuffer.size.y;
+
+  return trim_cache(view->cache, MAX(view->cache->bytes - bytes, keep));
+}
+
+static long get_backbuffer_bytes(void *data)
+{
+  view_t *view = (view_t *) data;
+
+  return 4L * view->backbuffer.size.x * view->backbuffer.size.y;
+}
+
 void *init_view(common_t *common)
 {
   view_t *view = malloc(sizeof(view_t));
+  GError *error = NULL;
 
-  // Resize the window
-  XResizeWindow(common->display, common->drawable, common->window_size.x, common->window_size.y);
+  view->common = common;
+  view->wmhints = NULL;
+  view->backbuffer.fallback = NULL;
 
-  // Set the window icon
-  view->wmhints = XAllocWMHints();
-  view->wmhints->flags |= IconPixmapHint;
-  view->wmhints->icon_pixmap = XCreatePixmapFromBitmapData(common->display,
-      common->drawable, icon_bits, 20, 20, 0, 0xffffff, 
-      DefaultDepth(common->display, 0));
-  XSetWMHints(common->display, common->drawable, view->wmhints);
+  // Without a display frames are only composed
+  if (!common->display)
+    view->backbuffer.backend = &offscreen_backend;
+  else {
+    // Resize the window
+    XResizeWindow(common->display, common->drawable, common->window_size.x, common->window_size.y);
 
-  XMapWindow(common->display, common->drawable);
-  view->common = common;
+    // Set the window icon
+    view->wmhints = XAllocWMHints();
+    view->wmhints->flags |= IconPixmapHint;
+    view->wmhints->icon_pixmap = XCreatePixmapFromBitmapData(common->display,
+        common->drawable, icon_bits, 20, 20, 0, 0xffffff, 
+        DefaultDepth(common->display, 0));
+    XSetWMHints(common->display, common->drawable, view->wmhints);
+
+    // Everything is drawn from the backbuffer, the server does not need
+    // to clear the window first
+    XSetWindowBackgroundPixmap(common->display, common->drawable, None);
 
-  view->history.scene_queue = malloc(sizeof(queue_t));
-  view->history.scene_queue->head = view->history.scene_queue->tail = 0;
+    XMapWindow(common->display, common->drawable);
 
-  view->history.surface_queue = malloc(sizeof(queue_t));
-  view->history.surface_queue->head = view->history.surface_queue->tail = 0;
+    view->backbuffer.backend = &shm_backend;
+    if (getenv("READERX_NO_SHM"))
+      view->backbuffer.fallback = "disabled by READERX_NO_SHM";
+    else if (!XShmQueryExtension(common->display))
+      view->backbuffer.fallback = "extension not available";
+    if (view->backbuffer.fallback)
+      view->backbuffer.backend = &pixmap_backend;
+
+    view->backbuffer.gc = XCreateGC(common->display, common->drawable, 0, NULL);
+  }
+
+  view->backbuffer.image = NULL;
+  view->backbuffer.pixmap = None;
+  view->backbuffer.surface = NULL;
+  view->backbuffer.cairo = NULL;
+  view->backbuffer.size.x = view->backbuffer.size.y = 0;
+  view->backbuffer.allocations = 0;
+  view->backbuffer.blit_bytes = view->backbuffer.blit_time = 0;
+  view->backbuffer.present_bytes = view->backbuffer.present_time = 0;
+
+  // Pages the view renders itself come from its own document, the
+  // model thread is using the other one
+  view->doc = poppler_document_new_from_bytes(common->document, NULL, &error);
+  if (!view->doc) {
+    LOG("Cannot open file %s: %s", common->input_file, error ? error->message : "");
+    if (error)
+      g_error_free(error);
+    return NULL;
+  }
+  view->pages = init_page_handles(view->doc);
 
-  view->history.cairo_queue = malloc(sizeof(queue_t));
-  view->history.cairo_queue->head = view->history.cairo_queue->tail = 0;
+  view->title[0] = '\0';
+  view->scene_capacity = 16;
+  view->scenes = malloc(view->scene_capacity * sizeof(scene_t *));
+
+  if (getenv("READERX_CACHE_MB"))
+    view->cache = init_cache(atol(getenv("READERX_CACHE_MB")) * 1024 * 1024);
+  else
+    view->cache = init_cache(PAGE_CACHE_BUDGET);
+
+  view->disk_cache = NULL;
+  if (getenv("READERX_DISK_CACHE_MB") && atol(getenv("READERX_DISK_CACHE_MB")) > 0)
+    view->disk_cache = init_disk_cache(common->document,
+        atol(getenv("READERX_DISK_CACHE_MB")) * 1024 * 1024);
+
+  view->pool = init_render_pool(common->document, getenv("READERX_WORKERS")
+      && atoi(getenv("READERX_WORKERS")) > 0 ? atoi(getenv("READERX_WORKERS")) : g_get_num_processors(),
+      common->wakeup_fd, view->disk_cache);
+  view->in_flight = g_hash_table_new_full(hash_cache_key, equal_cache_keys, free, NULL);
+  view->generation = 0;
+  view->redraw = 0;
+  view->wakeups = view->wakeup_latency = view->max_wakeup_latency = 0;
+  view->full_frames = view->scroll_frames = 0;
+  view->render_time = 0;
+  view->hud_under = NULL;
+  view->hud_drawn = 0;
+  view->highlights = malloc(HIGHLIGHT_MAX * sizeof(hit_t));
+  view->placeholder_capacity = 64;
+  view->placeholders = malloc(view->placeholder_capacity * sizeof(scene_t));
+  view->num_of_placeholders = 0;
+  view->selected = -1;
+  view->thumbnails_filled = 0;
+
+  register_cache(common->governor, "page cache", view, get_page_cache_bytes, evict_pages);
+  register_cache(common->governor, "backbuffer", view, get_backbuffer_bytes, NULL);
 
   return view;
 }
@@ -47,72 +140,754 @@ void deinit_view(void *data)
 {
   view_t *view = (view_t *) data;
 
-  XFreePixmap(view->common->display, view->wmhints->icon_pixmap);
-  XFree(view->wmhints);
+  if (get_stats_stream()) {
+    print_cache_stats(view->cache, get_stats_stream());
+    if (view->disk_cache)
+      print_disk_cache_stats(view->disk_cache, get_stats_stream());
+    if (view->pool)
+      print_render_stats(view->pool, get_stats_stream());
+    fprintf(get_stats_stream(), "backbuffer: %d x %d, %ld allocations\n",
+        view->backbuffer.size.x, view->backbuffer.size.y, view->backbuffer.allocations);
+    if (view->backbuffer.fallback)
+      fprintf(get_stats_stream(), "backbuffer: %s fallback, %s\n",
+          view->backbuffer.backend->name, view->backbuffer.fallback);
+    else
+      fprintf(get_stats_stream(), "backbuffer: %s\n", view->backbuffer.backend->name);
+    print_bandwidth(get_stats_stream(), "blit", view->backbuffer.blit_bytes, view->backbuffer.blit_time);
+    print_bandwidth(get_stats_stream(), "present", view->backbuffer.present_bytes,
+        view->backbuffer.present_time);
+    fprintf(get_stats_stream(), "frames: %ld full, %ld scrolled\n",
+        view->full_frames, view->scroll_frames);
+    if (view->thumbnails_filled)
+      fprintf(get_stats_stream(), "overview: %ld thumbnails filled in after their frame\n",
+          view->thumbnails_filled);
+    if (view->wakeups)
+      fprintf(get_stats_stream(), "render wakeup: latency %ld us avg, %ld us max\n",
+          view->wakeup_latency / view->wakeups, view->max_wakeup_latency);
+  }
 
-  free(view->history.scene_queue);
-  free(view->history.surface_queue);
-  free(view->history.cairo_queue);
+  if (view->pool)
+    deinit_render_pool(view->pool);
+  if (view->disk_cache)
+    deinit_disk_cache(view->disk_cache);
 
+  free_backbuffer(view);
+  if (view->common->display) {
+    XFreeGC(view->common->display, view->backbuffer.gc);
+    XFreePixmap(view->common->display, view->wmhints->icon_pixmap);
+    XFree(view->wmhints);
+  }
+  if (view->hud_under)
+    cairo_surface_destroy(view->hud_under);
+  g_hash_table_destroy(view->in_flight);
+  deinit_cache(view->cache);
+  deinit_page_handles(view->pages);
+  g_object_unref(view->doc);
+
+  free(view->scenes);
+  free(view->highlights);
+  free(view->placeholders);
   free(view);
 }
 
 void update_title(view_t *view)
 {
+  char title[TITLE_MAX];
+
   // Set the window name, strip the "file:///" part and 
   // concatenate the program name with the filepath
-  strcat(view->common->window_title, view->common->input_file + 7);
-  view->window_title.value = view->common->window_title;
+  snprintf(title, TITLE_MAX, "%s%s", view->frame->title, view->common->input_file + 7);
+  if (!strcmp(title, view->title))
+    return;
+
+  strcpy(view->title, title);
+  view->window_title.value = view->title;
   view->window_title.encoding = XA_STRING;
   view->window_title.format = 8;
   view->window_title.nitems = strlen(view->window_title.value);
 
-  XSetWMName(view->common->display, view->common->drawable, &(view->window_title));
+  if (view->common->display)
+    XSetWMName(view->common->display, view->common->drawable, &(view->window_title));
 }
 
-void display_scene(view_t *view)
+void free_backbuffer(view_t *view)
+{
+  backbuffer_t *backbuffer = &view->backbuffer;
+
+  if (!backbuffer->cairo)
+    return;
+
+  cairo_destroy(backbuffer->cairo);
+  backbuffer->backend->destroy(view);
+  backbuffer->cairo = NULL;
+}
+
+// The backbuffer follows the window size, it is only reallocated when
+// the window is resized
+void resize_backbuffer(view_t *view)
+{
+  backbuffer_t *backbuffer = &view->backbuffer;
+  dim_t window_size = view->frame->window_size;
+
+  if (backbuffer->cairo && backbuffer->size.x == window_size.x
+      && backbuffer->size.y == window_size.y)
+    return;
+
+  free_backbuffer(view);
+  backbuffer->size = window_size;
+  view->hud_drawn = 0;
+
+  if (!backbuffer->backend->create(view)) {
+    LOG("MIT-SHM not usable: %s", backbuffer->fallback);
+    backbuffer->backend = &pixmap_backend;
+    backbuffer->backend->create(view);
+  }
+
+  backbuffer->cairo = cairo_create(backbuffer->surface);
+  backbuffer->allocations++;
+
+  LOG("Backbuffer allocated: %d x %d", backbuffer->size.x, backbuffer->size.y);
+}
+
+// Move the last frame by the scroll distance
+void scroll_backbuffer(view_t *view, dim_t scroll)
+{
+  backbuffer_t *backbuffer = &view->backbuffer;
+
+  cairo_surface_flush(backbuffer->surface);
+  backbuffer->backend->scroll(view, scroll);
+  cairo_surface_mark_dirty(backbuffer->surface);
+}
+
+// Parts of the window the frame draws, the strips exposed by a scroll
+// or the whole window
+int get_damage(view_t *view, XRectangle *damage)
+{
+  frame_t *frame = view->frame;
+  dim_t size = frame->window_size;
+  int count = 0;
+
+  if (view->redraw) {
+    damage[count++] = (XRectangle) { 0, 0, size.x, size.y };
+    return count;
+  }
+
+  if (frame->scroll.y > 0)
+    damage[count++] = (XRectangle) { 0, 0, size.x, frame->scroll.y };
+  if (frame->scroll.y < 0)
+    damage[count++] = (XRectangle) { 0, size.y + frame->scroll.y, size.x, -frame->scroll.y };
+  if (frame->scroll.x > 0)
+    damage[count++] = (XRectangle) { 0, 0, frame->scroll.x, size.y };
+  if (frame->scroll.x < 0)
+    damage[count++] = (XRectangle) { size.x + frame->scroll.x, 0, -frame->scroll.x, size.y };
+
+  return count;
+}
+
+void present_backbuffer(view_t *view)
+{
+  backbuffer_t *backbuffer = &view->backbuffer;
+  long start = g_get_monotonic_time();
+
+  cairo_surface_flush(backbuffer->surface);
+  backbuffer->backend->present(view);
+  if (view->common->input_fd >= 0)
+    write(view->common->input_fd, &(uint64_t) { 1 }, sizeof(uint64_t));
+
+  backbuffer->present_bytes += (long) backbuffer->size.x * backbuffer->size.y * 4;
+  backbuffer->present_time += g_get_monotonic_time() - start;
+  add_sample(view->common->profiler, PRESENT_STAGE, g_get_monotonic_time() - start);
+}
+
+// Copy a rendered page or tile into the backbuffer, for the Xlib
+// fallback this uploads the pixels to the server
+void blit_surface(view_t *view, cairo_surface_t *surface, int x, int y)
+{
+  backbuffer_t *backbuffer = &view->backbuffer;
+  long start = g_get_monotonic_time();
+
+  cairo_set_source_surface(backbuffer->cairo, surface, x, y);
+  cairo_paint(backbuffer->cairo);
+  cairo_surface_flush(backbuffer->surface);
+
+  backbuffer->blit_bytes += (long) cairo_image_surface_get_stride(surface)
+    * cairo_image_surface_get_height(surface);
+  backbuffer->blit_time += g_get_monotonic_time() - start;
+}
+
+// Ask the render pool for a page or tile unless it is cached, one on its
+// way is kept from being cancelled as stale
+void request_surface(view_t *view, cache_key_t *key, render_priority_t priority)
+{
+  cache_key_t *in_flight;
+  render_job_t *job;
+
+  if (!view->pool || key->page_no < 0 || peek_cached_surface(view->cache, key))
+    return;
+
+  if ((job = g_hash_table_lookup(view->in_flight, key))) {
+    g_atomic_int_set(&job->generation, view->generation);
+    return;
+  }
+
+  in_flight = malloc(sizeof(cache_key_t));
+  *in_flight = *key;
+  job = submit_render_job(view->pool, key, priority, view->generation);
+  g_hash_table_insert(view->in_flight, in_flight, job);
+}
+
+void store_surface(view_t *view, render_job_t *job)
+{
+  g_hash_table_remove(view->in_flight, &job->key);
+
+  if (job->surface) {
+    cache_surface(view->cache, &job->key, job->surface);
+    job->surface = NULL;
+  }
+  free_render_job(job);
+}
+
+// Wait for a surface the render pool is working on
+cairo_surface_t *wait_for_surface(view_t *view, cache_key_t *key)
+{
+  long start = g_get_monotonic_time();
+
+  while (!peek_cached_surface(view->cache, key) && g_hash_table_lookup(view->in_flight, key))
+    store_surface(view, collect_render_job(view->pool, 1));
+
+  view->render_time += g_get_monotonic_time() - start;
+  return peek_cached_surface(view->cache, key);
+}
+
+int is_tiled_scene(scene_t *scene)
+{
+  return is_tiled(scene->page_size.x * scene->scaling.x, scene->page_size.y * scene->scaling.y);
+}
+
+// Range of tiles of a scene that intersect a rectangle of the window
+int get_tile_range(scene_t *scene, XRectangle *rect, dim_t *first, dim_t *last)
+{
+  int width = ceil(scene->page_size.x * scene->scaling.x);
+  int height = ceil(scene->page_size.y * scene->scaling.y);
+  int x0 = MAX(0, rect->x - scene->offset.x);
+  int y0 = MAX(0, rect->y - scene->offset.y);
+  int x1 = MIN(width, rect->x + rect->width - scene->offset.x);
+  int y1 = MIN(height, rect->y + rect->height - scene->offset.y);
+
+  if (x0 >= x1 || y0 >= y1)
+    return 0;
+
+  first->x = x0 / TILE_SIZE;
+  first->y = y0 / TILE_SIZE;
+  last->x = (x1 - 1) / TILE_SIZE;
+  last->y = (y1 - 1) / TILE_SIZE;
+
+  return 1;
+}
+
+void request_tiles(view_t *view, scene_t *scene, XRectangle *rect, render_priority_t priority)
+{
+  cache_key_t key;
+  dim_t first, last;
+  int x, y;
+
+  if (!get_tile_range(scene, rect, &first, &last))
+    return;
+
+  for (y = first.y; y <= last.y; y++)
+    for (x = first.x; x <= last.x; x++) {
+      key = get_cache_key(scene->page_no, scene->scaling.x, x, y);
+      if (priority != VISIBLE_PRIORITY || !find_cached_surface(view->cache, &key))
+        request_surface(view, &key, priority);
+    }
+}
+
+void draw_tiles(view_t *view, scene_t *scene, XRectangle *rect)
+{
+  cairo_surface_t *tile;
+  cache_key_t key;
+  dim_t first, last;
+  long start;
+  int x, y;
+
+  if (!get_tile_range(scene, rect, &first, &last))
+    return;
+
+  for (y = first.y; y <= last.y; y++)
+    for (x = first.x; x <= last.x; x++) {
+      key = get_cache_key(scene->page_no, scene->scaling.x, x, y);
+
+      // Animation frames only composite, the tile comes later
+      if (view->frame->animated) {
+        if (!(tile = peek_cached_surface(view->cache, &key))) {
+          g_atomic_int_set(&view->common->incomplete, 1);
+          continue;
+        }
+      }
+      // Render it here if the pool could not
+      else if (!(tile = wait_for_surface(view, &key))) {
+        start = g_get_monotonic_time();
+        tile = render_tile(get_page_handle(view->pages, scene->page_no), key.scaling, key.tile);
+        cache_surface(view->cache, &key, tile);
+        view->render_time += g_get_monotonic_time() - start;
+      }
+
+      blit_surface(view, tile, scene->offset.x + x * TILE_SIZE, scene->offset.y + y * TILE_SIZE);
+    }
+}
+
+// Render the part of a page inside the current clip straight into the
+// backbuffer, so a scroll costs the exposed strip and not the page
+void render_strip(view_t *view, scene_t *scene)
+{
+  cairo_t *cairo = view->backbuffer.cairo;
+  long start = g_get_monotonic_time();
+
+  cairo_save(cairo);
+  cairo_translate(cairo, scene->offset.x, scene->offset.y);
+  cairo_scale(cairo, scene->scaling.x, scene->scaling.y);
+
+  // PDF background color
+  cairo_set_source_rgb(cairo, 1, 1, 1);
+  cairo_rectangle(cairo, 0, 0, scene->page_size.x, scene->page_size.y);
+  cairo_fill(cairo);
+
+  poppler_page_render(get_page_handle(view->pages, scene->page_no), cairo);
+  cairo_restore(cairo);
+
+  view->render_time += g_get_monotonic_time() - start;
+}
+
+// Drawn over the page bitmap, moving between matches costs a blit of
+// the cached pages and no rendering
+void draw_highlights(view_t *view, scene_t *scene)
+{
+  cairo_t *cairo = view->backbuffer.cairo;
+  frame_t *frame = view->frame;
+  hit_t *hit;
+  int count, i;
+
+  if (!frame->search
+      || !(count = get_page_hits(frame->search, scene->page_no, view->highlights, HIGHLIGHT_MAX)))
+    return;
+
+  // Multiplied so the text stays readable
+  cairo_save(cairo);
+  cairo_set_operator(cairo, CAIRO_OPERATOR_MULTIPLY);
+  for (i = 0; i < count; i++) {
+    hit = &view->highlights[i];
+    if (scene->page_no == frame->hit_page && hit->match == frame->hit)
+      cairo_set_source_rgb(cairo, 1, 0.6, 0.2);
+    else
+      cairo_set_source_rgb(cairo, 1, 0.93, 0.3);
+    cairo_rectangle(cairo, scene->offset.x + hit->x * scene->scaling.x,
+        scene->offset.y + hit->y * scene->scaling.y,
+        hit->width * scene->scaling.x, hit->height * scene->scaling.y);
+    cairo_fill(cairo);
+  }
+  cairo_restore(cairo);
+}
+
+cache_key_t get_thumbnail_key(scene_t *scene)
+{
+  return get_cache_key(scene->page_no, scene->scaling.x, THUMBNAIL, THUMBNAIL);
+}
+
+void draw_placeholder(view_t *view, scene_t *scene)
+{
+  cairo_t *cairo = view->backbuffer.cairo;
+  char number[16];
+
+  cairo_save(cairo);
+  cairo_set_source_rgb(cairo, PLACEHOLDER_GRAY, PLACEHOLDER_GRAY, PLACEHOLDER_GRAY);
+  cairo_rectangle(cairo, scene->offset.x, scene->offset.y,
+      ceil(scene->page_size.x * scene->scaling.x), ceil(scene->page_size.y * scene->scaling.y));
+  cairo_fill(cairo);
+
+  snprintf(number, sizeof(number), "%d", scene->page_no + 1);
+  cairo_set_source_rgb(cairo, 0.5, 0.5, 0.5);
+  cairo_set_font_size(cairo, HUD_LINE_HEIGHT);
+  cairo_move_to(cairo, scene->offset.x + 4, scene->offset.y + HUD_LINE_HEIGHT + 2);
+  cairo_show_text(cairo, number);
+  cairo_restore(cairo);
+}
+
+void draw_selection(view_t *view, scene_t *scene)
+{
+  cairo_t *cairo = view->backbuffer.cairo;
+
+  cairo_save(cairo);
+  cairo_set_source_rgb(cairo, 0.2, 0.4, 0.9);
+  cairo_set_line_width(cairo, SELECTION_WIDTH);
+  cairo_rectangle(cairo, scene->offset.x - SELECTION_WIDTH, scene->offset.y - SELECTION_WIDTH,
+      ceil(scene->page_size.x * scene->scaling.x) + 2 * SELECTION_WIDTH,
+      ceil(scene->page_size.y * scene->scaling.y) + 2 * SELECTION_WIDTH);
+  cairo_stroke(cairo);
+  cairo_restore(cairo);
+}
+
+// Thumbnails are never waited for, the ones still missing are drawn as
+// placeholders and filled in when the render pool has them
+void display_overview(view_t *view, scene_t **scenes, int num_of_scenes)
 {
   scene_t *scene;
-  cairo_surface_t *surface;
+  cairo_surface_t *thumbnail;
+  cache_key_t key;
   cairo_t *cairo;
+  long start;
+  int embedded, i;
+
+  for (i = 0; i < num_of_scenes; i++) {
+    key = get_thumbnail_key(scenes[i]);
+    request_surface(view, &key, scenes[i]->visible ? VISIBLE_PRIORITY : PREFETCH_PRIORITY);
+  }
 
-  // Process scene queue
-  while (scene = (scene_t *) dequeue(view->scene_queue)) {
-    surface = cairo_xlib_surface_create(view->common->display, 
-      view->common->drawable, DefaultVisualOfScreen(view->common->screen), 0, 0);
+  // Rows scrolled past are not rendered any more
+  if (view->pool)
+    set_render_generation(view->pool, view->generation);
 
-    cairo_xlib_surface_set_drawable(surface, view->common->drawable, 
-        scene->page_size.x * scene->scaling.x + scene->offset.x,
-        scene->page_size.y * scene->scaling.y + scene->offset.y);
+  if (!view->redraw)
+    return;
 
-    cairo_surface_set_device_scale(surface, scene->scaling.x, scene->scaling.y);
-    cairo_surface_set_device_offset(surface, scene->offset.x, scene->offset.y);
+  resize_backbuffer(view);
+  cairo = view->backbuffer.cairo;
+  restore_hud(view);
+  view->full_frames++;
+  view->selected = view->frame->selected;
+  view->num_of_placeholders = 0;
 
-    cairo = cairo_create(surface);
+  cairo_set_source_rgb(cairo, ((READERX_BACKGROUND_LIGHT >> 16) & 0xFF) / 255.0,
+      ((READERX_BACKGROUND_LIGHT >> 8) & 0xFF) / 255.0, (READERX_BACKGROUND_LIGHT & 0xFF) / 255.0);
+  cairo_paint(cairo);
 
-    // PDF background color
-    cairo_set_source_rgb(cairo, 1,1,1);
-    cairo_rectangle(cairo, 0, 0, view->common->window_size.x, view->common->window_size.y);
-    cairo_fill(cairo);
+  for (i = 0; i < num_of_scenes; i++) {
+    scene = scenes[i];
+    if (!scene->visible)
+      continue;
+
+    key = get_thumbnail_key(scene);
+    thumbnail = find_cached_surface(view->cache, &key);
+
+    // Render it here if there is no pool
+    if (!thumbnail && !view->pool) {
+      start = g_get_monotonic_time();
+      thumbnail = render_thumbnail(get_page_handle(view->pages, scene->page_no), key.scaling,
+          &embedded);
+      cache_surface(view->cache, &key, thumbnail);
+      view->render_time += g_get_monotonic_time() - start;
+    }
+
+    if (thumbnail)
+      blit_surface(view, thumbnail, scene->offset.x, scene->offset.y);
+    else {
+      draw_placeholder(view, scene);
+      if (view->num_of_placeholders == view->placeholder_capacity) {
+        view->placeholder_capacity *= 2;
+        view->placeholders = realloc(view->placeholders, view->placeholder_capacity * sizeof(scene_t));
+      }
+      view->placeholders[view->num_of_placeholders++] = *scene;
+    }
+
+    if (scene->page_no == view->selected)
+      draw_selection(view, scene);
+  }
+
+  draw_hud(view);
+  present_backbuffer(view);
+}
+
+// Thumbnails that came in after their frame go where their placeholder
+// is, no new frame is needed
+void fill_placeholders(view_t *view)
+{
+  cairo_surface_t *thumbnail;
+  scene_t *scene;
+  cache_key_t key;
+  int filled = 0, i = 0;
+
+  while (i < view->num_of_placeholders) {
+    scene = &view->placeholders[i];
+    key = get_thumbnail_key(scene);
+    if (!(thumbnail = peek_cached_surface(view->cache, &key))) {
+      i++;
+      continue;
+    }
+
+    if (!filled++)
+      restore_hud(view);
+    blit_surface(view, thumbnail, scene->offset.x, scene->offset.y);
+    if (scene->page_no == view->selected)
+      draw_selection(view, scene);
+    view->placeholders[i] = view->placeholders[--view->num_of_placeholders];
+  }
+
+  if (filled) {
+    view->thumbnails_filled += filled;
+    draw_hud(view);
+    present_backbuffer(view);
+  }
+}
+
+// Put back what the overlay covered in the last frame, so scrolling
+// moves page content only
+void restore_hud(view_t *view)
+{
+  cairo_t *cairo = view->backbuffer.cairo;
+
+  if (!view->hud_drawn)
+    return;
+
+  cairo_save(cairo);
+  cairo_set_source_surface(cairo, view->hud_under, HUD_X, HUD_Y);
+  cairo_rectangle(cairo, HUD_X, HUD_Y, HUD_WIDTH, HUD_HEIGHT);
+  cairo_fill(cairo);
+  cairo_restore(cairo);
+  view->hud_drawn = 0;
+}
+
+void draw_hud(view_t *view)
+{
+  profiler_t *profiler = view->common->profiler;
+  cairo_t *cairo = view->backbuffer.cairo, *under;
+  cache_t *cache = view->cache;
+  histogram_t *histogram;
+  char line[STR_MAX];
+  int stage, counter, y = HUD_Y + HUD_LINE_HEIGHT;
+
+  if (!profiler || !g_atomic_int_get(&profiler->hud))
+    return;
 
-    poppler_page_render(scene->page, cairo);
+  get_profile(profiler, view->hud_stages, view->hud_counters);
 
-    g_object_unref(scene->page);
-    free(scene);
+  if (!view->hud_under)
+    view->hud_under = cairo_image_surface_create(CAIRO_FORMAT_RGB24, HUD_WIDTH, HUD_HEIGHT);
 
-    /*
-    cairo_destroy(cairo);
-    free(cairo);
-    cairo_surface_destroy(surface);
-    */
+  under = cairo_create(view->hud_under);
+  cairo_set_source_surface(under, view->backbuffer.surface, -HUD_X, -HUD_Y);
+  cairo_paint(under);
+  cairo_destroy(under);
+  view->hud_drawn = 1;
+
+  cairo_save(cairo);
+  cairo_set_source_rgba(cairo, 0, 0, 0, 0.75);
+  cairo_rectangle(cairo, HUD_X, HUD_Y, HUD_WIDTH, HUD_HEIGHT);
+  cairo_fill(cairo);
+
+  cairo_select_font_face(cairo, "monospace", CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_NORMAL);
+  cairo_set_font_size(cairo, HUD_LINE_HEIGHT - 3);
+  cairo_set_source_rgb(cairo, 1, 1, 1);
+
+  // Timings of the last frames, the current one is not finished yet
+  for (stage = 0; stage < STAGE_COUNT; stage++, y += HUD_LINE_HEIGHT) {
+    histogram = &view->hud_stages[stage];
+    snprintf(line, STR_MAX, "%-8s p50 %7.2f  p95 %7.2f  max %7.2f ms", get_stage_name(stage),
+        get_rolling_percentile(histogram, 50) / 1000.0, get_rolling_percentile(histogram, 95) / 1000.0,
+        histogram->max / 1000.0);
+    cairo_move_to(cairo, HUD_X + 4, y);
+    cairo_show_text(cairo, line);
+  }
+
+  for (counter = 0; counter < COUNTER_COUNT; counter++, y += HUD_LINE_HEIGHT) {
+    histogram = &view->hud_counters[counter];
+    snprintf(line, STR_MAX, "%-8s p50 %7ld  p95 %7ld  max %7ld", get_counter_name(counter),
+        get_rolling_percentile(histogram, 50), get_rolling_percentile(histogram, 95), histogram->max);
+    cairo_move_to(cairo, HUD_X + 4, y);
+    cairo_show_text(cairo, line);
+  }
+
+  snprintf(line, STR_MAX, "%-8s %ld%% hits, %ld MiB", "cache",
+      cache->hits + cache->misses ? cache->hits * 100 / (cache->hits + cache->misses) : 0,
+      cache->bytes >> 20);
+  cairo_move_to(cairo, HUD_X + 4, y);
+  cairo_show_text(cairo, line);
+  y += HUD_LINE_HEIGHT;
+
+  snprintf(line, STR_MAX, "%-8s %ld MiB", "rss", get_rss() >> 20);
+  cairo_move_to(cairo, HUD_X + 4, y);
+  cairo_show_text(cairo, line);
+
+  cairo_restore(cairo);
+}
+
+// Take all scenes of the frame, the array only grows
+int dequeue_scenes(view_t *view)
+{
+  int count = 0;
+
+  while ((count += dequeue_batch(view->frame->scenes, view->scenes + count,
+          view->scene_capacity - count)) == view->scene_capacity) {
+    view->scene_capacity *= 2;
+    view->scenes = realloc(view->scenes, view->scene_capacity * sizeof(scene_t *));
+  }
+
+  return count;
+}
+
+void display_scene(view_t *view)
+{
+  scene_t *scene, **scenes;
+  render_job_t *job;
+  cache_key_t key;
+  cairo_surface_t *page;
+  cairo_t *cairo;
+  frame_t *frame = view->frame;
+  XRectangle damage[2], around;
+  int num_of_damages, num_of_scenes, first, last, i, j;
+  long start;
+
+  // Pick up pages that were rendered in the background
+  if (view->pool)
+    while (job = collect_render_job(view->pool, 0))
+      store_surface(view, job);
+
+  num_of_scenes = dequeue_scenes(view);
+  scenes = view->scenes;
+
+  if (frame->overview) {
+    display_overview(view, scenes, num_of_scenes);
+    return;
+  }
+  view->num_of_placeholders = 0;
+
+  num_of_damages = get_damage(view, damage);
+  around = (XRectangle) { -TILE_SIZE, -TILE_SIZE,
+    frame->window_size.x + 2 * TILE_SIZE, frame->window_size.y + 2 * TILE_SIZE };
+
+  // Process scene queue, missing pages are rendered by the pool. Pages
+  // in scrolled strips are drawn here unless the pool already has them,
+  // large pages only need the tiles in the damaged part of the window.
+  for (i = 0; i < num_of_scenes; i++) {
+    scene = scenes[i];
+    if (is_tiled_scene(scene)) {
+      for (j = 0; j < num_of_damages; j++)
+        request_tiles(view, scene, &damage[j], VISIBLE_PRIORITY);
+      request_tiles(view, scene, &around, PREFETCH_PRIORITY);
+    }
+    else {
+      key = get_cache_key(scene->page_no, scene->scaling.x, WHOLE_PAGE, WHOLE_PAGE);
+      if (!find_cached_surface(view->cache, &key))
+        request_surface(view, &key, view->redraw || frame->animated ? VISIBLE_PRIORITY : PREFETCH_PRIORITY);
+    }
   }
+
+  // Prefetch the neighbouring pages
+  if (num_of_scenes && !is_tiled_scene(scenes[0])) {
+    first = scenes[0]->page_no;
+    last = scenes[num_of_scenes - 1]->page_no;
+    key = get_cache_key(first - 1, scenes[0]->scaling.x, WHOLE_PAGE, WHOLE_PAGE);
+    request_surface(view, &key, PREFETCH_PRIORITY);
+    key.page_no = last + 1;
+    request_surface(view, &key, PREFETCH_PRIORITY);
+    key.page_no = first - 2;
+    request_surface(view, &key, BACKGROUND_PRIORITY);
+    key.page_no = last + 2;
+    request_surface(view, &key, BACKGROUND_PRIORITY);
+  }
+
+  // Everything this frame needs is tagged, older renders can go
+  if (view->pool)
+    set_render_generation(view->pool, view->generation);
+
+  if (!num_of_damages)
+    return;
+
+  resize_backbuffer(view);
+  cairo = view->backbuffer.cairo;
+  restore_hud(view);
+
+  if (view->redraw)
+    view->full_frames++;
+  else {
+    scroll_backbuffer(view, frame->scroll);
+    view->scroll_frames++;
+  }
+
+  // Clip to the damaged part of the window
+  cairo_new_path(cairo);
+  for (j = 0; j < num_of_damages; j++)
+    cairo_rectangle(cairo, damage[j].x, damage[j].y, damage[j].width, damage[j].height);
+  cairo_clip(cairo);
+
+  // Window background
+  cairo_set_source_rgb(cairo, ((READERX_BACKGROUND_LIGHT >> 16) & 0xFF) / 255.0,
+      ((READERX_BACKGROUND_LIGHT >> 8) & 0xFF) / 255.0, (READERX_BACKGROUND_LIGHT & 0xFF) / 255.0);
+  cairo_paint(cairo);
+
+  for (i = 0; i < num_of_scenes; i++) {
+    scene = scenes[i];
+
+    if (is_tiled_scene(scene)) {
+      for (j = 0; j < num_of_damages; j++)
+        draw_tiles(view, scene, &damage[j]);
+    }
+    else {
+      key = get_cache_key(scene->page_no, scene->scaling.x, WHOLE_PAGE, WHOLE_PAGE);
+
+      // Wait for the visible page, animation frames only take what is
+      // cached and leave the background until the animation settles
+      if (view->redraw && !frame->animated)
+        page = wait_for_surface(view, &key);
+      else
+        page = peek_cached_surface(view->cache, &key);
+
+      if (!page && frame->animated)
+        g_atomic_int_set(&view->common->incomplete, 1);
+      else if (!page && !view->redraw)
+        render_strip(view, scene);
+      else {
+        // Render it here if the pool could not
+        if (!page) {
+          start = g_get_monotonic_time();
+          page = render_page(get_page_handle(view->pages, scene->page_no), key.scaling);
+          cache_surface(view->cache, &key, page);
+          view->render_time += g_get_monotonic_time() - start;
+        }
+
+        blit_surface(view, page, scene->offset.x, scene->offset.y);
+      }
+    }
+
+    draw_highlights(view, scene);
+  }
+
+  cairo_reset_clip(cairo);
+  draw_hud(view);
+  present_backbuffer(view);
 }
 
-void view_main(void *data, queue_t *scene_queue)
+void view_main(void *data, frame_t *frame)
 {
   view_t *view = (view_t *) data;
-  view->scene_queue = scene_queue;
+  view->frame = frame;
+  view->generation = frame->generation;
+
+  view->redraw = frame->redraw;
+  view->render_time = 0;
 
   display_scene(view);
+  reset_arena(frame->arena);
+  add_sample(view->common->profiler, RENDER_STAGE, view->render_time);
   update_title(view);
 }
+
+// Render workers finished some pages while the view thread was asleep
+void view_wakeup(void *data)
+{
+  view_t *view = (view_t *) data;
+  render_job_t *job;
+  long latency;
+
+  if (!view->pool)
+    return;
+
+  while (job = collect_render_job(view->pool, 0)) {
+    latency = g_get_monotonic_time() - job->finished;
+    view->wakeups++;
+    view->wakeup_latency += latency;
+    if (latency > view->max_wakeup_latency)
+      view->max_wakeup_latency = latency;
+    store_surface(view, job);
+  }
+
+  fill_placeholders(view);
+}